@@ -0,0 +1,151 @@
+#ifndef ANALYZER_HPP
+#define ANALYZER_HPP
+
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <fftw3.h>
+#include "spectrogram.hpp"
+#include "narrowband.hpp"
+
+// 多声道文件的分析方式
+enum class ChannelMode {
+    Mono,       // 混缩为单声道
+    Channels,   // 每个声道单独分析
+    MidSide,    // 立体声的左、右、中、侧四路
+};
+
+// 解码后的音频片段
+struct AudioClip {
+    int sampleRate = 0;
+    int channels = 0;                          // 原始声道数
+    std::vector<std::vector<double>> tracks;   // 待分析的各路信号，单声道模式下只有一路
+    std::vector<std::string> trackNames;       // 各路信号的名称
+};
+
+// 按 mode 准备片段的各路信号名称并清空数据；mode 与声道数不匹配时返回 false
+bool initAudioClip(int channels, int sampleRate, ChannelMode mode, AudioClip& clip, std::string& error);
+
+// 将 frames 帧交错采样按 mode 拆分后追加到片段的各路信号中
+void appendAudioFrames(const double* interleaved, size_t frames, ChannelMode mode, AudioClip& clip);
+
+// 读取音频文件中 [start_time, start_time + duration) 的部分，一次解码并按 mode 拆分为各路信号
+// 失败时返回 false，错误信息写入 error
+bool decodeAudioFile(const std::string& filename,
+                     const Spectrogram::Config& config,
+                     ChannelMode mode,
+                     AudioClip& clip,
+                     std::string& error);
+
+// FFTW 的计划器不是线程安全的，创建和销毁计划时需要持有该锁
+std::mutex& fftwPlannerMutex();
+
+// FFTW 计划和汉宁窗表，按 FFT 大小在进程内共享
+// 创建后只读，多个线程可以用各自的缓冲区同时执行同一个计划
+class FftPlan {
+public:
+    static std::shared_ptr<const FftPlan> get(int fftSize);
+    ~FftPlan();
+
+    FftPlan(const FftPlan&) = delete;
+    FftPlan& operator=(const FftPlan&) = delete;
+
+    int size;
+    std::vector<double> window;
+    fftw_plan plan;
+
+private:
+    explicit FftPlan(int fftSize);
+};
+
+// 短时傅里叶变换分析器
+// 使用共享的 FFT 计划和窗表，只持有自己的输入输出缓冲区，可对任意多个片段重复使用。
+// 单个实例不是线程安全的，每个分析线程应持有自己的实例。
+class StftAnalyzer {
+public:
+    explicit StftAnalyzer(int fftSize = 2048);
+    ~StftAnalyzer();
+
+    StftAnalyzer(const StftAnalyzer&) = delete;
+    StftAnalyzer& operator=(const StftAnalyzer&) = delete;
+
+    // 计算频谱图，每帧 fftSize/2+1 个归一化到 [0, 1] 的强度值
+    std::vector<std::vector<double>> compute(const std::vector<double>& samples, int hopSize);
+    std::vector<std::vector<double>> compute(const double* samples, size_t count, int hopSize);
+
+    // 计算多分辨率分析中的一个频段：帧以 i * hopSize 为中心，
+    // 只保存 [minFreq, maxFreq] 范围内的 bin
+    Spectrogram::Band computeBand(const std::vector<double>& samples, int sampleRate,
+                                  int hopSize, double minFreq, double maxFreq);
+    Spectrogram::Band computeBand(const double* samples, size_t count, int sampleRate,
+                                  int hopSize, double minFreq, double maxFreq);
+
+    int getFftSize() const { return fftSize; }
+
+    // 显示的动态范围（dB），低于满刻度该值的能量显示为黑色
+    static constexpr double kDynamicRangeDb = 80.0;
+
+private:
+    // 对从 offset 开始的一帧加窗并执行 FFT，越界部分补零
+    void transform(const double* samples, size_t count, long offset);
+    // 最近一次变换中第 bin 个输出的强度
+    double binIntensity(int bin) const;
+
+    int fftSize;
+    std::shared_ptr<const FftPlan> fft;
+    double* in;
+    fftw_complex* out;
+};
+
+// 多分辨率分析中一个频段的参数
+struct BandPlan {
+    int fft_size;
+    int hop_size;
+    double min_freq;
+    double max_freq;
+};
+
+// 为一组 FFT 大小划分频段：较短的窗在其长度容纳 kCyclesPerWindow 个周期后接管，
+// 窗长超过 referenceFft 的频段按比例增大帧间隔
+std::vector<BandPlan> planBands(std::vector<int> fftSizes, int sampleRate, int baseHop,
+                                int referenceFft, double minFreq, double maxFreq);
+
+constexpr double kCyclesPerWindow = 32.0;
+
+// 按 FFT 大小缓存分析器，使缓冲区在多个文件之间复用
+// 与 StftAnalyzer 一样，每个线程应持有自己的实例
+class AnalyzerCache {
+public:
+    StftAnalyzer& get(int fftSize);
+
+    // 分析一路信号；resolutionFfts 为空时使用 fftSize 的单一分辨率。
+    // [min_freq, max_freq] 过窄时改用窄带分析，忽略 resolutionFfts
+    std::vector<Spectrogram::Band> analyze(const std::vector<double>& samples,
+                                           int sampleRate,
+                                           const Spectrogram::Config& config,
+                                           int fftSize,
+                                           const std::vector<int>& resolutionFfts);
+
+    // 同上，直接读取调用者的 count 个采样，不复制
+    std::vector<Spectrogram::Band> analyze(const double* samples,
+                                           size_t count,
+                                           int sampleRate,
+                                           const Spectrogram::Config& config,
+                                           int fftSize,
+                                           const std::vector<int>& resolutionFfts);
+
+    // 分析片段中的所有信号，多路信号最多使用 threads 个线程并发计算
+    std::vector<std::vector<Spectrogram::Band>> analyze(const AudioClip& clip,
+                                                        const Spectrogram::Config& config,
+                                                        int fftSize,
+                                                        const std::vector<int>& resolutionFfts,
+                                                        int threads = 1);
+
+private:
+    std::map<int, std::unique_ptr<StftAnalyzer>> analyzers;
+    std::unique_ptr<NarrowBandAnalyzer> narrowBand;
+};
+
+#endif // ANALYZER_HPP
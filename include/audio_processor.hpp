@@ -1,24 +1,80 @@
-#pragma once
+#ifndef AUDIO_PROCESSOR_HPP
+#define AUDIO_PROCESSOR_HPP
 
 #include <vector>
 #include <string>
-#include <sndfile.h>
-#include <fftw3.h>
+#include "analyzer.hpp"
+#include "lazy_analyzer.hpp"
+#include "spectrogram.hpp"
 
+// 进程内调用的频谱分析接口
+//
+// 输入可以是音频文件路径，也可以是调用者持有的交错 PCM 缓冲区；分析和渲染都在进程内完成，
+// 不经过文件系统。频谱数据通过 getTracks() 以引用返回，RGB 像素写入调用者提供的内存或
+// 可复用的缓冲区。FFT 计划、分析缓冲区和解码缓冲区在多次调用之间复用。
+// 单个实例不是线程安全的，每个线程应持有自己的实例。
 class AudioProcessor {
 public:
-    AudioProcessor();
-    ~AudioProcessor();
-    
-    bool loadAudioFile(const std::string& filename);
-    std::vector<std::vector<double>> computeSpectrogram(int windowSize = 2048, int hopSize = 512);
+    struct Options {
+        Spectrogram::Config spec;                        // 时间范围、每秒帧数和频率范围
+        int fft_size = 2048;                             // 单一分辨率的窗长
+        std::vector<int> resolution_ffts;                // 多分辨率的窗长，为空时不启用
+        ChannelMode channel_mode = ChannelMode::Mono;    // 多声道的分析方式
+        int threads = 1;                                 // 多路信号并发分析的线程数
+    };
+
+    AudioProcessor() = default;
+    explicit AudioProcessor(const Options& options);
+
+    void setOptions(const Options& options) { this->options = options; }
+    const Options& getOptions() const { return options; }
+
+    // 解码并分析音频文件中 [start_time, start_time + duration) 的部分
+    bool analyzeFile(const std::string& filename, std::string& error);
+
+    // 分析调用者的交错 PCM，frames 为每个声道的采样数，同样按 start_time/duration 截取。
+    // 单声道 double 数据直接读取，不复制；其他情况拆分到复用的内部缓冲区
+    bool analyzeSamples(const double* samples, size_t frames, int channels, int sampleRate,
+                        std::string& error);
+    bool analyzeSamples(const float* samples, size_t frames, int channels, int sampleRate,
+                        std::string& error);
+
+    // 快速预览：只解码并计算让 width 列覆盖整个片段所需的帧，
+    // 之后 getTracks() 返回每列一帧的结果，render() 的宽度应为 getPreviewWidth()
+    bool previewFile(const std::string& filename, int width, std::string& error);
+    int getPreviewWidth() const { return previewConfig.width; }
+
+    // 在预览之后补齐其余的帧，得到与 analyzeFile() 相同的完整结果，已计算的帧不会重复计算
+    bool refine(std::string& error);
+
+    // 最近一次分析的结果，在下一次分析前有效
+    const std::vector<Spectrogram::Track>& getTracks() const { return tracks; }
+    const std::vector<std::string>& getTrackNames() const { return trackNames; }
     int getSampleRate() const { return sampleRate; }
 
+    // 将最近一次分析的结果渲染为 RGB 像素，写入调用者提供的 height 行、每行 stride 字节的内存
+    bool render(unsigned char* pixels, int width, int height, size_t stride, std::string& error);
+
+    // 同上，写入可复用的缓冲区，容量足够时不重新分配
+    bool render(std::vector<unsigned char>& pixels, int width, int height, std::string& error);
+
+    // 渲染并编码为内存中的 PNG
+    bool encodePng(std::vector<unsigned char>& png, std::string& error);
+
 private:
-    std::vector<float> audioData;
-    int sampleRate;
-    int channels;
-    
-    std::vector<double> computeFFT(const std::vector<double>& window);
-    void applyHannWindow(std::vector<double>& window);
-}; 
\ No newline at end of file
+    // 按 start_time/duration 截取 [first, first + count) 帧
+    void selectRange(size_t frames, int sampleRate, size_t& first, size_t& count) const;
+
+    Options options;
+    AnalyzerCache analyzers;
+    LazyAnalyzer lazy;
+    Spectrogram::Config previewConfig;
+    Spectrogram spectrogram;
+    AudioClip clip;
+    std::vector<double> convertBuffer;
+    std::vector<Spectrogram::Track> tracks;
+    std::vector<std::string> trackNames;
+    int sampleRate = 0;
+};
+
+#endif // AUDIO_PROCESSOR_HPP
@@ -0,0 +1,123 @@
+#ifndef FINGERPRINT_HPP
+#define FINGERPRINT_HPP
+
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+#include "spectrogram.hpp"
+
+// 频谱指纹：成对能量峰的哈希
+//
+// 每个分析频段的帧在时间上按 50 ms 分组，每组在若干对数频带内取能量上升最快的峰（音符起始处）；
+// 每个峰与其后不远处的几个峰配对，哈希由两峰的频率（四分之一半音）和时间差组成。
+// 频率和时间都换算为与采样率、FFT 大小、每秒帧数无关的单位，重新编码或截取的同一段录音
+// 会产生大量相同的哈希，且时间差一致。
+struct FingerprintHash {
+    uint32_t hash;
+    uint32_t time;   // 锚点峰的时间（10 ms）
+};
+
+// 从一路频谱计算指纹，结果按时间排序
+std::vector<FingerprintHash> computeFingerprint(const Spectrogram::Track& track, int sampleRate);
+
+// 持久化的指纹倒排索引
+//
+// 索引目录中包含：
+//   files.tsv       每行一个文件：编号、大小、修改时间、哈希数、输入路径、输出图像路径、渲染选项摘要、时长
+//   prints/<编号>   每个文件的指纹，查询已索引文件时无需重新解码
+//   segments/<序号> 按哈希排序的 (哈希, 文件编号, 时间) 记录，查询时内存映射后二分查找；
+//                   每次添加写一个新段，大小相近的段凑满一定数量后合并为一个
+//   segments/MANIFEST 有效段的序号，以改名原子替换；不在其中的段是中断留下的，打开时删除
+// 输入和输出路径不能含有制表符或换行符。
+// 单个实例不是线程安全的；同一目录同时只应由一个进程写入。
+class FingerprintIndex {
+public:
+    struct Entry {
+        uint32_t id = 0;
+        uint64_t size = 0;          // 索引时输入文件的大小
+        int64_t mtime = 0;          // 索引时输入文件的修改时间
+        uint32_t hash_count = 0;
+        std::string input_file;     // 绝对路径
+        std::string output_file;    // 生成的频谱图
+        std::string options;        // 生成频谱图时的渲染选项摘要，选项不同的图像不能复用
+        double duration = 0.0;      // 分析片段的时长（秒），早期的索引没有记录时为 0
+    };
+
+    struct Match {
+        const Entry* entry = nullptr;
+        double similarity = 0.0;    // 时间差一致的相同哈希占较长一方哈希数的比例，只有首尾都吻合时接近 1
+        double coverage = 0.0;      // 同上，占较短一方的比例；截取的片段与完整录音之间也接近 1
+        double offset = 0.0;        // 查询片段相对该文件的起点（秒）
+    };
+
+    FingerprintIndex() = default;
+    ~FingerprintIndex();
+
+    FingerprintIndex(const FingerprintIndex&) = delete;
+    FingerprintIndex& operator=(const FingerprintIndex&) = delete;
+
+    // 打开索引目录，不存在时创建
+    bool open(const std::string& directory, std::string& error);
+
+    // 按输入路径查找，path 会转换为绝对路径
+    const Entry* find(const std::string& path) const;
+
+    // 文件自索引以来是否未被修改
+    bool unchanged(const Entry& entry) const;
+
+    // 读取已索引文件的指纹
+    bool loadFingerprint(const Entry& entry, std::vector<FingerprintHash>& hashes, std::string& error) const;
+
+    // 按相似度降序返回最多 maxResults 个结果，忽略编号为 excludeId 的文件
+    // 结果中的 entry 在索引销毁前有效
+    std::vector<Match> query(const std::vector<FingerprintHash>& hashes,
+                             size_t maxResults,
+                             int64_t excludeId = -1) const;
+
+    // 添加一个文件的指纹并立即写入磁盘，options 为生成 outputFile 时的渲染选项摘要，
+    // duration 为计算指纹的片段时长（秒）
+    bool add(const std::string& inputFile,
+             const std::string& outputFile,
+             const std::string& options,
+             const std::vector<FingerprintHash>& hashes,
+             double duration,
+             std::string& error);
+
+    size_t size() const { return entries.size(); }
+
+private:
+    struct Posting {
+        uint32_t hash;
+        uint32_t file;
+        uint32_t time;
+    };
+
+    struct Segment {
+        uint64_t number = 0;
+        void* mapping = nullptr;
+        size_t mappedBytes = 0;
+        const Posting* postings = nullptr;
+        size_t count = 0;
+    };
+
+    std::string segmentPath(uint64_t number) const;
+    bool mapSegment(uint64_t number, std::string& error);
+    // 记录当前的文件数和有效段
+    bool writeManifest(const std::vector<uint64_t>& numbers, std::string& error);
+    // 排序后写成新段并加入清单
+    bool appendSegment(std::vector<Posting>& postings, std::string& error);
+    // 合并所有凑满 kMergeFactor 个的同级段
+    bool mergeSegments(std::string& error);
+    bool mergeSegments(const std::vector<size_t>& selected, std::string& error);
+    void unmapAll();
+
+    std::string directory;
+    std::deque<Entry> entries;
+    std::unordered_map<std::string, size_t> byPath;
+    std::vector<Segment> segments;
+    uint64_t nextSegment = 0;
+};
+
+#endif // FINGERPRINT_HPP
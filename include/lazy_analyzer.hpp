@@ -0,0 +1,84 @@
+#ifndef LAZY_ANALYZER_HPP
+#define LAZY_ANALYZER_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <map>
+#include <sndfile.h>
+#include "analyzer.hpp"
+#include "spectrogram.hpp"
+
+// 按需计算帧的频谱分析，用于快速预览
+//
+// open() 只读取文件头。preview() 只解码并计算目标宽度实际需要的帧，帧间隔大于窗长时
+// 直接定位到每一帧的位置读取，耗时与文件长度基本无关。预览阶段只按帧下标保存已计算的帧，
+// 内存也与文件长度无关。refine() 补齐其余的帧，已经计算过的帧不会重复计算，
+// 结果与一次性完整分析相同。
+// 只使用单一分辨率；单个实例不是线程安全的。
+class LazyAnalyzer {
+public:
+    LazyAnalyzer() = default;
+    ~LazyAnalyzer();
+
+    LazyAnalyzer(const LazyAnalyzer&) = delete;
+    LazyAnalyzer& operator=(const LazyAnalyzer&) = delete;
+
+    // 打开文件中 [start_time, start_time + duration) 的部分，帧间隔为 sampleRate/samples_per_sec
+    bool open(const std::string& filename,
+              const Spectrogram::Config& config,
+              ChannelMode mode,
+              int fftSize,
+              std::string& error);
+
+    // 计算让 width 列覆盖整个片段所需的帧，返回每列一帧的频谱；
+    // previewConfig 为渲染该预览使用的配置，图像宽度为实际列数
+    bool preview(int width,
+                 std::vector<Spectrogram::Track>& tracks,
+                 Spectrogram::Config& previewConfig,
+                 std::string& error);
+
+    // 计算其余的帧，之后 getTracks() 返回完整分辨率的频谱
+    bool refine(std::string& error);
+
+    // refine() 之后为完整分辨率的频谱，之前各频段没有帧；在下一次 open() 前有效
+    const std::vector<Spectrogram::Track>& getTracks() const { return tracks; }
+
+    size_t frameCount() const { return numFrames; }
+    size_t computedCount() const { return numComputed; }
+    int getSampleRate() const { return info.samplerate; }
+    int getChannels() const { return info.channels; }
+    const std::vector<std::string>& getTrackNames() const { return window.trackNames; }
+
+private:
+    void close();
+    // 计算下标为 step 整数倍且尚未计算的帧
+    bool computeFrames(size_t step, std::string& error);
+    bool isComputed(size_t frame) const;
+    // 读取片段内从 offset 开始的 count 帧，拆分到 window 中
+    bool readWindow(sf_count_t offset, sf_count_t count, std::string& error);
+    // 计算第 frame 帧，窗口数据从 window 的第 base 个采样开始
+    void computeFrame(size_t frame, size_t base);
+
+    std::string filename;
+    SNDFILE* file = nullptr;
+    SF_INFO info = {};
+    sf_count_t position = 0;                  // 文件中下一次读取的位置
+    Spectrogram::Config config;
+    ChannelMode mode = ChannelMode::Mono;
+    int fftSize = 2048;
+    int hopSize = 441;
+    sf_count_t startFrame = 0;                // 片段在文件中的起点
+    sf_count_t numSamples = 0;                // 片段长度
+    size_t numFrames = 0;
+    size_t numComputed = 0;
+
+    std::unique_ptr<StftAnalyzer> analyzer;
+    AudioClip window;                         // 当前读入的采样，按声道模式拆分
+    std::vector<double> buffer;               // 交错的读取缓冲区
+    // refine() 之前已计算的帧，各路按帧下标存放
+    std::vector<std::map<size_t, std::vector<double>>> sparseFrames;
+    std::vector<Spectrogram::Track> tracks;   // 完整分辨率的结果，refine() 时才分配全部帧
+};
+
+#endif // LAZY_ANALYZER_HPP
@@ -0,0 +1,88 @@
+#ifndef MSA_H
+#define MSA_H
+
+/*
+ * 频谱分析的 C 接口，是 AudioProcessor 的薄封装，便于从其他语言嵌入调用。
+ *
+ * 返回 int 的函数以 1 表示成功、0 表示失败，失败原因可通过 msa_last_error 获取。
+ * 每个接受处理器的函数在开始时清除上一次的错误，成功后 msa_last_error 返回空字符串。
+ * 内部的 C++ 异常（如内存不足）不会穿过接口，同样以失败返回。
+ * 一个处理器不是线程安全的，每个线程应创建自己的处理器。
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct msa_processor msa_processor;
+
+/* 声道模式 */
+enum {
+    MSA_CHANNELS_MONO = 0,      /* 混缩为单声道 */
+    MSA_CHANNELS_SEPARATE = 1,  /* 每个声道一路 */
+    MSA_CHANNELS_MID_SIDE = 2   /* 立体声的左、右、中、侧四路 */
+};
+
+typedef struct {
+    double start_time;            /* 开始时间（秒） */
+    double duration;              /* 持续时间（秒），小于等于 0 表示直到结束 */
+    int samples_per_sec;          /* 每秒帧数 */
+    double min_freq;              /* 最低频率（Hz） */
+    double max_freq;              /* 最高频率（Hz） */
+    int fft_size;                 /* 单一分辨率的窗长 */
+    const int* resolution_ffts;   /* 多分辨率的窗长，为 NULL 时不启用 */
+    int num_resolution_ffts;
+    int channel_mode;             /* MSA_CHANNELS_* */
+    int threads;                  /* 多路信号并发分析的线程数 */
+} msa_options;
+
+/* 一个频段的描述，频谱数据按帧优先存放：第 i 帧第 k 个值对应 FFT bin first_bin + k，
+ * 窄带分析时对应频率 freqs[k] */
+typedef struct {
+    int fft_size;
+    int hop_size;
+    int first_bin;
+    double min_freq;
+    double max_freq;
+    size_t num_frames;
+    size_t num_bins;
+    const double* freqs;          /* 窄带分析时各值的频率（Hz），否则为 NULL；在下一次分析前有效 */
+} msa_band_info;
+
+/* 以默认值填充选项 */
+void msa_default_options(msa_options* options);
+
+/* options 为 NULL 时使用默认值；选项无效（如 resolution_ffts 中有小于 16 的值）或失败时返回 NULL */
+msa_processor* msa_create(const msa_options* options);
+void msa_destroy(msa_processor* processor);
+
+/* 最近一次调用失败的原因，最近一次调用成功时为空字符串；在下一次调用前有效 */
+const char* msa_last_error(const msa_processor* processor);
+
+/* 分析音频文件或调用者的交错 PCM（frames 为每个声道的采样数） */
+int msa_analyze_file(msa_processor* processor, const char* path);
+int msa_analyze_pcm_f64(msa_processor* processor, const double* samples, size_t frames,
+                        int channels, int sample_rate);
+int msa_analyze_pcm_f32(msa_processor* processor, const float* samples, size_t frames,
+                        int channels, int sample_rate);
+
+/* 最近一次分析的结果 */
+int msa_track_count(const msa_processor* processor);
+int msa_band_count(const msa_processor* processor, int track);
+int msa_band_info_get(const msa_processor* processor, int track, int band, msa_band_info* info);
+
+/* 将一个频段的强度（[0, 1]）按帧优先复制到 out，返回需要的元素数；
+ * capacity 小于该值时不写入，可先以 out = NULL 查询大小。
+ * 频段在内部按帧分别存放，因此这里总会复制一次，代价远小于分析本身 */
+size_t msa_copy_band(const msa_processor* processor, int track, int band, double* out, size_t capacity);
+
+/* 将最近一次分析的结果渲染为 RGB 像素，写入 height 行、每行 stride 字节的内存 */
+int msa_render_rgb(msa_processor* processor, unsigned char* pixels, int width, int height, size_t stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSA_H */
@@ -0,0 +1,71 @@
+#ifndef NARROWBAND_HPP
+#define NARROWBAND_HPP
+
+#include <vector>
+#include <complex>
+#include <fftw3.h>
+#include "spectrogram.hpp"
+
+// 窄带分析，用于 -l/-u 只覆盖几个半音的情况
+//
+// 全频带 FFT 在这样的范围内只有少数几个 bin。这里先把信号复解调到频带中心并低通抽取，
+// 得到只包含该频带的低采样率基带信号，再用更长的窗逐帧求频谱，且只在图像各行中心的
+// 频率处求值。每帧的求值方式按代价自动选择：
+//   Goertzel 组：对每个行频率运行一次 Goertzel 递推，代价为 窗长×行数，按频率向量化
+//   缩放 FFT：补零后做一次复数 FFT，在行频率处插值，代价约为 M log M
+// 行数少（如预览）时 Goertzel 组更快，否则缩放 FFT 更快。
+// 单个实例不是线程安全的，每个分析线程应持有自己的实例。
+class NarrowBandAnalyzer {
+public:
+    enum class Method {
+        Goertzel,
+        ZoomFft,
+    };
+
+    NarrowBandAnalyzer() = default;
+    ~NarrowBandAnalyzer();
+
+    NarrowBandAnalyzer(const NarrowBandAnalyzer&) = delete;
+    NarrowBandAnalyzer& operator=(const NarrowBandAnalyzer&) = delete;
+
+    // 全频带 fftSize 点 FFT 在 [min_freq, max_freq] 内的 bin 过少时使用窄带分析
+    static bool applies(const Spectrogram::Config& config, int sampleRate, int fftSize);
+
+    // 计算 [min_freq, max_freq] 的频谱：帧以 i * hopSize 为中心，窗长不短于 fftSize，
+    // 每帧 config.height 个强度值，频率为 band.freqs，与同样高度图像的各行中心一致
+    Spectrogram::Band compute(const double* samples, size_t count, int sampleRate,
+                              int hopSize, const Spectrogram::Config& config, int fftSize);
+
+    // 最近一次 compute 选用的求值方式
+    Method getMethod() const { return method; }
+
+private:
+    // 在基带信号中从 start 开始的一帧上求各行频率的强度
+    void goertzel(long start, std::vector<double>& column);
+    void zoomFft(long start, std::vector<double>& column);
+    // 幅度换算为与 StftAnalyzer 相同的归一化强度
+    double intensity(double magnitude) const;
+    // 确保 FFT 计划和缓冲区的大小为 size
+    void preparePlan(int size);
+
+    Method method = Method::ZoomFft;
+    std::vector<std::complex<double>> baseband;  // 抽取后的基带信号
+    std::vector<double> window;                  // 基带上的汉宁窗
+    std::vector<double> omegas;                  // 各行频率相对频带中心的数字角频率
+    double reference = 1.0;                      // 满刻度正弦波的幅度
+
+    // Goertzel 组的状态，按频率连续存放以便向量化
+    std::vector<double> coefficients;
+    std::vector<double> stateRe1, stateRe2, stateIm1, stateIm2;
+
+    // 缩放 FFT
+    int planSize = 0;
+    fftw_plan plan = nullptr;
+    fftw_complex* in = nullptr;
+    fftw_complex* out = nullptr;
+    std::vector<double> magnitudes;              // 各 bin 的强度
+    std::vector<int> rowBins;                    // 离各行频率最近的 bin
+    std::vector<double> rowOffsets;              // 各行频率相对该 bin 的偏移（bin 数，-0.5 到 0.5）
+};
+
+#endif // NARROWBAND_HPP
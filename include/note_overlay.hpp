@@ -0,0 +1,58 @@
+#ifndef NOTE_OVERLAY_HPP
+#define NOTE_OVERLAY_HPP
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// 叠加层的配色
+struct OverlayPalette {
+    unsigned char line[3] = {255, 255, 255};   // 刻度线颜色
+    unsigned char line_alpha = 128;            // 刻度线不透明度，与 Core Graphics 路径的 0.5 相同
+    unsigned char text[3] = {255, 255, 255};   // 标签颜色
+    unsigned char text_alpha = 255;
+};
+
+// 音符刻度和标签的叠加层，用于没有 Core Graphics 的平台
+//
+// 与 Core Graphics 路径相同，在每一路频谱中为第 1 到第 8 八度的自然音画横线，并在左侧
+// 用内嵌的点阵字体标注音名。叠加层按图像尺寸、路数、频率范围和配色光栅化一次后缓存，
+// 之后同样参数的图像只需一次混合：每个有内容的行段按字节做 out = (dst * (255 - a) + c * a) / 255，
+// 循环内只有 16 位整数运算，可以向量化。刻度线在标签右侧的部分只存一个像素和重复次数，
+// 因此叠加层的大小与图像宽度无关，也可以用于流式渲染的超宽图像。
+class NoteOverlay {
+public:
+    // 返回缓存的叠加层，不存在时光栅化；多个线程可以同时调用并共享结果
+    static std::shared_ptr<const NoteOverlay> get(int width, int height, int panels,
+                                                  double minFreq, double maxFreq,
+                                                  const OverlayPalette& palette = OverlayPalette());
+
+    // 将叠加层混合到 height 行、每行 stride 字节的 RGB 图像上
+    void blend(unsigned char* pixels, size_t stride) const;
+
+    // 将第 y 行中从第 x 列开始的 count 个像素混合到 rgb 上，用于逐行生成的图像
+    void blendRow(int y, size_t x, unsigned char* rgb, size_t count) const;
+
+    // 有内容的行段数
+    size_t spanCount() const { return spans.size(); }
+
+private:
+    // 一行中从第 x 列开始的像素，按字节存放 255 - a 和预乘的 c * a；
+    // 之后的 repeat 个像素与最后一个像素相同
+    struct Span {
+        int y;
+        int x;
+        std::vector<uint8_t> inverse;
+        std::vector<uint16_t> premultiplied;
+        size_t repeat = 0;
+    };
+
+    // 将行段中从第 from 个像素开始的 count 个像素混合到 out
+    static void blendSpan(const Span& span, size_t from, size_t count, unsigned char* out);
+
+    NoteOverlay(int width, int height, int panels, double minFreq, double maxFreq, const OverlayPalette& palette);
+
+    std::vector<Span> spans;
+};
+
+#endif // NOTE_OVERLAY_HPP
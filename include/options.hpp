@@ -0,0 +1,27 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include "spectrogram.hpp"
+#include "pipeline.hpp"
+
+// 命令行与服务请求共用的处理选项
+struct Options {
+    Spectrogram::Config spec;
+    Pipeline::Config pipeline;
+    bool help = false;   // 选项中出现了 -h
+};
+
+// 解析 <输入> <输出> 之后的选项列表
+// log 非空时输出每个选项的设置结果；失败时返回 false，错误信息写入 error
+bool parseOptions(const std::vector<std::string>& args,
+                  Options& options,
+                  std::string& error,
+                  std::ostream* log = nullptr);
+
+// 输出目录中与输入文件同名的 PNG 路径
+std::string outputFileFor(const std::string& inputFile, const std::string& outputDir);
+
+#endif // OPTIONS_HPP
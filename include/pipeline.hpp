@@ -0,0 +1,102 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include "spectrogram.hpp"
+#include "analyzer.hpp"
+
+// 有界阻塞队列，用于在流水线各阶段之间传递数据并提供背压
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+    // 队列满时阻塞；队列已关闭时返回 false
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // 不阻塞；队列已满或已关闭时返回 false
+    bool tryPush(T item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed || items.size() >= capacity) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // 队列空时阻塞；队列已关闭且取空后返回 false
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // 关闭后不再接受新数据，已入队的数据仍可取出
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed = false;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+};
+
+// 解码 -> 分析 -> 渲染/编码 三阶段流水线
+// 当第 N 个文件在编码时，第 N+1 个文件在分析，第 N+2 个文件在解码。
+class Pipeline {
+public:
+    struct Config {
+        int decode_threads = 1;      // 解码线程数
+        int analyze_threads = 1;     // FFT 分析线程数
+        int render_threads = 1;      // 渲染和 PNG 编码线程数
+        size_t queue_depth = 2;      // 阶段之间的队列容量
+        int fft_size = 2048;         // FFT 大小
+        std::vector<int> resolution_ffts;  // 多分辨率分析的 FFT 大小，为空时只用 fft_size
+        ChannelMode channel_mode = ChannelMode::Mono;  // 多声道文件的分析方式
+        bool preview = false;        // 只计算图像宽度需要的帧，生成覆盖整个片段的缩略图
+        size_t max_memory = 0;       // 大于 0 时使用流式渲染，峰值内存不超过该预算（字节）
+        bool stream_fit_width = false;  // 流式渲染的图像宽度为 Spectrogram::Config::width，否则每帧一列
+        std::string index_dir;       // 指纹索引目录，非空时跳过已处理的文件并链接重复的录音
+        double duplicate_similarity = 0.5;  // 判定为重复录音的最低相似度（相同哈希占较长一方的比例）
+    };
+
+    struct Job {
+        std::string inputFile;
+        std::string outputFile;
+    };
+
+    Pipeline(const Config& config, const Spectrogram::Config& specConfig);
+
+    // 处理所有任务，返回成功生成的图像数量
+    size_t run(const std::vector<Job>& jobs);
+
+private:
+    // 流式渲染：逐个文件边解码边渲染，整个片段输出为一张图像
+    size_t runStreaming(const std::vector<Job>& jobs);
+
+    Config config;
+    Spectrogram::Config specConfig;
+};
+
+#endif // PIPELINE_HPP
@@ -0,0 +1,44 @@
+#ifndef PNG_STREAM_HPP
+#define PNG_STREAM_HPP
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+// 逐行写出的 PNG 编码器（8 位 RGB，无过滤）
+// 扫描线按顺序送入 zlib，压缩输出每满一个缓冲区就写成一个 IDAT 块，
+// 内存占用与图像尺寸无关。一行可以分多次写入。
+class PngStreamWriter {
+public:
+    PngStreamWriter() = default;
+    ~PngStreamWriter();
+
+    PngStreamWriter(const PngStreamWriter&) = delete;
+    PngStreamWriter& operator=(const PngStreamWriter&) = delete;
+
+    // 创建文件并写出文件头
+    bool open(const std::string& filename, int width, int height, std::string& error);
+
+    // 写入当前行的下一段像素，size 为字节数；写满一行后自动开始下一行
+    bool write(const unsigned char* rgb, size_t size);
+
+    // 写出剩余的压缩数据和文件尾；所有行都已写入时返回 true
+    bool finish(std::string& error);
+
+private:
+    bool deflateInput(const unsigned char* data, size_t size, int flush);
+    bool writeChunk(const char* type, const unsigned char* data, size_t size);
+    void close();
+
+    FILE* file = nullptr;
+    z_stream stream = {};
+    bool streamReady = false;
+    bool ok = false;
+    size_t rowBytes = 0;        // 每行像素字节数
+    size_t rowRemaining = 0;    // 当前行还需写入的字节数
+    int rowsRemaining = 0;      // 尚未开始的行数
+    std::vector<unsigned char> output;
+};
+
+#endif // PNG_STREAM_HPP
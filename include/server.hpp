@@ -0,0 +1,48 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <vector>
+#include <string>
+
+// 常驻服务模式
+//
+// 服务在本地 Unix 域套接字上接收任务，工作线程及其 FFT 计划、窗表在请求之间保持常驻。
+// 每条消息由 4 字节大端长度和负载组成，一个连接上可以连续发送多个请求。
+// 工作线程只在处理请求时占用连接，请求之间的空闲连接由接收线程等待；
+// 工作线程和等待队列都满时回复失败并关闭连接，不阻塞接收。
+//
+// 请求负载：以 '\0' 分隔的字段
+//   <模式> <输入文件> <输出目录> [命令行选项...]
+//   模式为 "path" 时服务写出 PNG 并返回其路径；为 "bytes" 时直接返回 PNG 数据，输出目录被忽略
+// 响应负载：1 字节状态（0 成功，1 失败），其后为图像路径、PNG 数据或错误信息
+
+class SpectrumServer {
+public:
+    struct Config {
+        std::string socket_path;     // 套接字路径
+        int workers = 0;             // 并发处理的工作线程数，0 表示使用硬件线程数
+    };
+
+    explicit SpectrumServer(const Config& config);
+
+    // 阻塞运行直到收到 SIGINT 或 SIGTERM；启动失败（包括已有服务在该路径上监听）时返回 false
+    bool run(std::string& error);
+
+    // 请求正在运行的服务停止，可以在其他线程中调用
+    static void stop();
+
+private:
+    Config config;
+};
+
+// 向服务发送一个任务
+// returnBytes 为 true 时 result 为 PNG 数据，否则为服务端写出的图像路径
+bool sendServerRequest(const std::string& socketPath,
+                       bool returnBytes,
+                       const std::string& inputFile,
+                       const std::string& outputDir,
+                       const std::vector<std::string>& options,
+                       std::string& result,
+                       std::string& error);
+
+#endif // SERVER_HPP
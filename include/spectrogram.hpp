@@ -16,30 +16,91 @@ public:
         int samples_per_sec = 100;   // 每秒采样次数
         double min_freq = 20.0;      // 最低频率（Hz）
         double max_freq = 20000.0;   // 最高频率（Hz）
+        int width = 3200;            // 图像宽度（像素），第 x 列对应时间 x/samples_per_sec 秒
+        int height = 2400;           // 图像高度（像素）
     };
-    
-    void generateSpectrogram(const std::vector<std::vector<double>>& specData,
+
+    // 一个频段的频谱数据。多分辨率分析时每个 FFT 大小对应一个频段，
+    // 只保存本频段负责的 bin，渲染时按时间和频率合并到同一张图中。
+    struct Band {
+        int fft_size = 2048;         // 窗长
+        int hop_size = 441;          // 帧间隔（采样数）
+        int first_bin = 0;           // frames[i][0] 对应的 FFT bin
+        double min_freq = 0.0;       // 本频段负责的频率下限（Hz）
+        double max_freq = 1e9;       // 本频段负责的频率上限（Hz）
+        std::vector<std::vector<double>> frames;  // 归一化到 [0, 1] 的强度
+        std::vector<double> freqs;   // 非空时 frames[i][k] 是频率 freqs[k]（升序）处的强度，用于窄带分析
+    };
+
+    // 一路信号的全部频段；多声道分析时每个声道一路，在图像中自上而下堆叠
+    using Track = std::vector<Band>;
+
+    // 单一分辨率的频谱图，每帧 fftSize/2+1 个 bin，帧间隔为 sampleRate/samples_per_sec
+    // 写入失败时返回 false
+    bool generateSpectrogram(const std::vector<std::vector<double>>& specData,
+                           const std::string& outputFile,
+                           int sampleRate,
+                           const Config& config);
+
+    // 多频段、多路频谱图，图像的第 x 列对应时间 x/samples_per_sec 秒，写入失败时返回 false
+    bool generateSpectrogram(const std::vector<Track>& tracks,
                            const std::string& outputFile,
                            int sampleRate,
                            const Config& config);
 
+    // 渲染频谱图并编码为内存中的 PNG
+    bool encodeSpectrogram(const std::vector<Track>& tracks,
+                           int sampleRate,
+                           const Config& config,
+                           std::vector<unsigned char>& png);
+
+    // 图像一行的数据来源：频段 band 中 [lo, hi] 范围内的 bin 取最大值，band 为 -1 表示没有数据
+    struct RowSource {
+        int band = -1;
+        int lo = 0;
+        int hi = 0;
+    };
+
+    // 计算一路频谱在 height 行高的图像中每一行的数据来源，第 0 行为最高频率
+    std::vector<RowSource> mapRows(const Track& bands, int sampleRate, const Config& config, int height);
+
+    // 强度 [0, 1] 对应的 RGB 颜色
+    static void intensityColor(double intensity, unsigned char* rgb);
+
+    // 将多路频谱自上而下堆叠渲染为 RGB 像素，各路之间以灰线分隔
+    // pixels 由调用者提供，至少 height 行，每行 stride 字节
+    void renderTracks(const std::vector<Track>& tracks,
+                      int sampleRate, const Config& config,
+                      int width, int height,
+                      unsigned char* pixels, size_t stride);
+
 private:
+    // 将一路频谱数据渲染为 RGB 像素，行跨度为 stride 字节
+    void renderPixels(const Track& bands,
+                      int sampleRate, const Config& config,
+                      int width, int height,
+                      unsigned char* pixels, size_t stride);
+
+
 #ifdef __APPLE__
-    void generateImageCG(const std::vector<std::vector<double>>& data,
-                        const std::string& outputFile,
-                        int width, int height,
-                        double minFreq, double maxFreq,
-                        int sampleRate);
+    // 渲染频谱和音符标注，调用者负责释放返回的图像
+    CGImageRef createImageCG(const std::vector<Track>& tracks,
+                             int width, int height,
+                             int sampleRate, const Config& config);
+    bool generateImageCG(const std::vector<Track>& tracks,
+                         const std::string& outputFile,
+                         int width, int height,
+                         int sampleRate, const Config& config);
 #else
-    void generateImageStb(const std::vector<std::vector<double>>& data,
+    bool generateImageStb(const std::vector<Track>& tracks,
                          const std::string& outputFile,
                          int width, int height,
-                         double minFreq, double maxFreq,
-                         int sampleRate);
+                         int sampleRate, const Config& config);
 #endif
 
     // 辅助函数
     double freqToY(double freq, int height, double minFreq, double maxFreq);
+    double yToFreq(double y, int height, double minFreq, double maxFreq);
     std::pair<std::string, int> getNoteAndOctave(double freq);
     bool isWhiteKey(const std::string& note);
 };
@@ -6,158 +6,132 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <stdarg.h>
 #include <string.h>
-#include <math.h>
-#include <assert.h>
+#include <zlib.h>
 
 typedef unsigned int stbiw_uint32;
-#define STBIW_ASSERT(x) assert(x)
 #define STBIW_MALLOC(sz)        malloc(sz)
-#define STBIW_REALLOC(p,newsz)  realloc(p,newsz)
 #define STBIW_FREE(p)           free(p)
 
 typedef unsigned char stbi_uc;
-typedef unsigned short stbi_us;
 
-typedef struct {
-   stbi_uc *data;
-   int w,h,comp;
-   const char *filename;
-} stbi__write_context;
+typedef void stbi_write_func(void *context, void *data, int size);
 
 extern int stbi_write_png(char const *filename, int w, int h, int comp, const void *data, int stride_in_bytes);
+extern int stbi_write_png_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void *data, int stride_in_bytes);
 
 #ifdef STB_IMAGE_WRITE_IMPLEMENTATION
 
-static void stbiw__writefv(FILE *f, const char *fmt, va_list v)
+static void stbiw__put32(unsigned char *b, stbiw_uint32 x)
 {
-   while (*fmt) {
-      switch (*fmt++) {
-         case ' ': break;
-         case '1': { unsigned char x = (unsigned char) va_arg(v, int); fputc(x,f); break; }
-         case '2': { int x = va_arg(v,int); unsigned char b[2];
-                     b[0] = (unsigned char) x; b[1] = (unsigned char) (x>>8);
-                     fwrite(b,2,1,f); break; }
-         case '4': { stbiw_uint32 x = va_arg(v,int); unsigned char b[4];
-                     b[0]=(unsigned char)x; b[1]=(unsigned char)(x>>8);
-                     b[2]=(unsigned char)(x>>16); b[3]=(unsigned char)(x>>24);
-                     fwrite(b,4,1,f); break; }
-         default:
-            STBIW_ASSERT(0);
-            return;
-      }
-   }
+   b[0] = (unsigned char)(x >> 24);
+   b[1] = (unsigned char)(x >> 16);
+   b[2] = (unsigned char)(x >> 8);
+   b[3] = (unsigned char)x;
 }
 
-static void stbiw__writef(FILE *f, const char *fmt, ...)
+// 写出一个 PNG 块：长度、类型、数据、CRC
+static void stbiw__write_chunk(stbi_write_func *func, void *context, const char *type, const unsigned char *data, stbiw_uint32 len)
 {
-   va_list v;
-   va_start(v, fmt);
-   stbiw__writefv(f, fmt, v);
-   va_end(v);
+   unsigned char b[8];
+   uLong crc = crc32(0L, (const Bytef *)type, 4);
+   if (len) crc = crc32(crc, data, len);
+
+   stbiw__put32(b, len);
+   memcpy(b + 4, type, 4);
+   func(context, b, 8);
+   if (len) func(context, (void *)data, (int)len);
+   stbiw__put32(b, (stbiw_uint32)crc);
+   func(context, b, 4);
 }
 
-static void stbiw__write_flush(stbi__write_context *s)
+// 生成 zlib 压缩的扫描线数据（每行使用 None 过滤器）
+static unsigned char *stbi_write_png_zlib(const unsigned char *pixels, int x, int y, int comp, int stride_bytes, uLongf *out_len)
 {
-   if (s->data) {
-      STBIW_FREE(s->data);
-      s->data = NULL;
+   size_t row = (size_t)x * comp;
+   size_t raw_len = (row + 1) * y;
+   unsigned char *raw = (unsigned char *) STBIW_MALLOC(raw_len);
+   unsigned char *out;
+   int j;
+   if (!raw) return NULL;
+
+   for (j = 0; j < y; ++j) {
+      raw[j * (row + 1)] = 0;
+      memcpy(raw + j * (row + 1) + 1, pixels + (size_t)j * stride_bytes, row);
    }
-}
-
-static void stbiw__write3(stbi__write_context *s, unsigned char a, unsigned char b, unsigned char c)
-{
-   s->data[s->comp * s->w * s->h + 0] = a;
-   s->data[s->comp * s->w * s->h + 1] = b;
-   s->data[s->comp * s->w * s->h + 2] = c;
-   s->comp = 3;
-}
-
-static void stbiw__write_pixel(stbi__write_context *s, int rgb_dir, int comp, int write_alpha, int expand_mono, unsigned char *d)
-{
-   unsigned char bg[3] = { 255, 255, 255 };
-   int k;
-
-   if (write_alpha < 0)
-      stbiw__write3(s, d[0], d[0], d[0]); // monochrome
-   else
-      stbiw__write3(s, d[0], d[1], d[2]); // color
-}
-
-static void stbiw__write_pixels(stbi__write_context *s, int rgb_dir, int vdir, int x, int y, int comp, void *data, int write_alpha, int scanline_pad, int expand_mono)
-{
-   stbiw_uint32 zero = 0;
-   int i,j, k;
-
-   if (y <= 0 || x <= 0) return;
 
-   if (s->data == NULL) {
-      s->data = (unsigned char *) STBIW_MALLOC(x * y * comp);
-      if (s->data == NULL) { 
-         STBIW_FREE(s);
-         return;
-      }
-   }
-
-   if (vdir < 0)
-      j = y-1;
-   else
-      j = 0;
-
-   for (; j >= 0 && j < y; j += vdir) {
-      for (i=0; i < x; ++i) {
-         unsigned char *d = (unsigned char *) data + (j*x+i)*comp;
-         stbiw__write_pixel(s, rgb_dir, comp, write_alpha, expand_mono, d);
-      }
+   *out_len = compressBound(raw_len);
+   out = (unsigned char *) STBIW_MALLOC(*out_len);
+   if (out && compress2(out, out_len, raw, raw_len, Z_DEFAULT_COMPRESSION) != Z_OK) {
+      STBIW_FREE(out);
+      out = NULL;
    }
+   STBIW_FREE(raw);
+   return out;
 }
 
-static int stbi_write_png_core(stbi__write_context *s, int stride_bytes)
+int stbi_write_png_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int stride_bytes)
 {
-   int p;
-   if (stride_bytes == 0)
-      stride_bytes = s->w * s->comp;
+   static const unsigned char signature[] = { 137,80,78,71,13,10,26,10 };
+   unsigned char ihdr[13];
+   unsigned char *idat;
+   uLongf idat_len;
 
    // compute color-based attributes for PNG
    int color_type = 0;
-   if (s->comp == 1) color_type = 0;
-   else if (s->comp == 2) color_type = 4;
-   else if (s->comp == 3) color_type = 2;
-   else if (s->comp == 4) color_type = 6;
-
-   FILE *f = fopen(s->filename, "wb");
-   if (!f) return 0;
+   if (comp == 1) color_type = 0;
+   else if (comp == 2) color_type = 4;
+   else if (comp == 3) color_type = 2;
+   else if (comp == 4) color_type = 6;
+   else return 0;
 
-   // write PNG header
-   unsigned char header[] = { 137,80,78,71,13,10,26,10 };
-   fwrite(header, 8, 1, f);
+   if (x <= 0 || y <= 0) return 0;
+   if (stride_bytes == 0)
+      stride_bytes = x * comp;
 
-   // write IHDR
-   stbiw__writef(f, "IHDR");
-   stbiw__writef(f, "%4d %4d %1d %1d %1d %1d %1d", s->w, s->h, 8, color_type, 0,0,0);
+   idat = stbi_write_png_zlib((const unsigned char *)data, x, y, comp, stride_bytes, &idat_len);
+   if (!idat) return 0;
 
-   // write IDAT
-   stbiw__writef(f, "IDAT");
-   fwrite(s->data, s->w * s->h * s->comp, 1, f);
+   stbiw__put32(ihdr, (stbiw_uint32)x);
+   stbiw__put32(ihdr + 4, (stbiw_uint32)y);
+   ihdr[8] = 8;            // bit depth
+   ihdr[9] = (unsigned char)color_type;
+   ihdr[10] = 0;           // compression
+   ihdr[11] = 0;           // filter
+   ihdr[12] = 0;           // interlace
 
-   // write IEND
-   stbiw__writef(f, "IEND");
+   func(context, (void *)signature, 8);
+   stbiw__write_chunk(func, context, "IHDR", ihdr, 13);
+   stbiw__write_chunk(func, context, "IDAT", idat, (stbiw_uint32)idat_len);
+   stbiw__write_chunk(func, context, "IEND", NULL, 0);
 
-   fclose(f);
+   STBIW_FREE(idat);
    return 1;
 }
 
+typedef struct {
+   FILE *f;
+   int ok;
+} stbiw__file_context;
+
+static void stbiw__file_write(void *context, void *data, int size)
+{
+   stbiw__file_context *c = (stbiw__file_context *)context;
+   if (c->ok && fwrite(data, 1, size, c->f) != (size_t)size) c->ok = 0;
+}
+
 int stbi_write_png(char const *filename, int x, int y, int comp, const void *data, int stride_bytes)
 {
-   stbi__write_context s;
-   s.data = NULL;
-   s.w = x;
-   s.h = y;
-   s.comp = comp;
-   s.filename = filename;
-   return stbi_write_png_core(&s, stride_bytes);
+   stbiw__file_context c;
+   c.f = fopen(filename, "wb");
+   if (!c.f) return 0;
+   c.ok = 1;
+
+   if (!stbi_write_png_to_func(stbiw__file_write, &c, x, y, comp, data, stride_bytes)) c.ok = 0;
+   if (fclose(c.f) != 0) c.ok = 0;
+   return c.ok;
 }
 
 #endif // STB_IMAGE_WRITE_IMPLEMENTATION
-#endif // INCLUDE_STB_IMAGE_WRITE_H 
\ No newline at end of file
+
+#endif // INCLUDE_STB_IMAGE_WRITE_H
@@ -0,0 +1,44 @@
+#ifndef STREAM_RENDERER_HPP
+#define STREAM_RENDERER_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "analyzer.hpp"
+#include "spectrogram.hpp"
+
+// 内存受限的流式渲染，用于任意长度的录音
+//
+// 边解码边做短时傅里叶变换，每一帧直接映射为图像的一列，整个片段渲染为一张宽度等于帧数的图像；
+// 指定宽度时各帧按时间归入对应的列，一列覆盖多帧时取最大值。
+// 列按块缓存为每像素 1 字节的强度，超出内存预算时块依次写入临时文件；编码时按行条带从各块
+// 读回（即从列块转置为行），经调色表着色并叠加音符刻度后逐行送入流式 PNG 编码器。
+// 峰值内存由 max_memory 决定，与录音长度无关。只使用单一分辨率。
+class StreamingRenderer {
+public:
+    struct Config {
+        size_t max_memory = size_t(256) << 20;        // 内存预算（字节）
+        int fft_size = 2048;                          // FFT 大小
+        ChannelMode channel_mode = ChannelMode::Mono; // 多声道文件的分析方式
+        int width = 0;                                // 图像宽度，0 表示每帧一列
+    };
+
+    StreamingRenderer(const Config& config, const Spectrogram::Config& specConfig);
+
+    // 渲染 [start_time, start_time + duration) 的部分并写入 PNG，图像高度为 specConfig.height
+    bool render(const std::string& inputFile, const std::string& outputFile, std::string& error);
+
+    // 最近一次渲染的图像宽度和写入临时文件的字节数
+    int getWidth() const { return width; }
+    uint64_t getSpilledBytes() const { return spilledBytes; }
+
+private:
+    Config config;
+    Spectrogram::Config specConfig;
+    AnalyzerCache analyzers;
+    Spectrogram spectrogram;
+    int width = 0;
+    uint64_t spilledBytes = 0;
+};
+
+#endif // STREAM_RENDERER_HPP
@@ -0,0 +1,353 @@
+#include "analyzer.hpp"
+#include <sndfile.h>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <thread>
+
+std::mutex& fftwPlannerMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+bool initAudioClip(int channels, int sampleRate, ChannelMode mode, AudioClip& clip, std::string& error) {
+    if (channels <= 0) {
+        error = "声道数无效: " + std::to_string(channels);
+        return false;
+    }
+    if (mode == ChannelMode::MidSide && channels != 2) {
+        error = "中/侧模式需要立体声文件，当前声道数: " + std::to_string(channels);
+        return false;
+    }
+
+    clip.sampleRate = sampleRate;
+    clip.channels = channels;
+    switch (mode) {
+        case ChannelMode::Mono:
+            clip.trackNames = {"Mono"};
+            break;
+        case ChannelMode::Channels:
+            clip.trackNames.clear();
+            for (int c = 0; c < channels; ++c) {
+                clip.trackNames.push_back("Ch" + std::to_string(c + 1));
+            }
+            break;
+        case ChannelMode::MidSide:
+            clip.trackNames = {"L", "R", "M", "S"};
+            break;
+    }
+    // 保留各路信号已分配的容量，便于重复使用同一个片段
+    clip.tracks.resize(clip.trackNames.size());
+    for (auto& track : clip.tracks) {
+        track.clear();
+    }
+    return true;
+}
+
+void appendAudioFrames(const double* interleaved, size_t frames, ChannelMode mode, AudioClip& clip) {
+    const int channels = clip.channels;
+    for (size_t i = 0; i < frames; ++i) {
+        const double* frame = &interleaved[i * channels];
+        switch (mode) {
+            case ChannelMode::Mono: {
+                double sum = 0.0;
+                for (int c = 0; c < channels; ++c) {
+                    sum += frame[c];
+                }
+                clip.tracks[0].push_back(sum / channels);
+                break;
+            }
+            case ChannelMode::Channels:
+                for (int c = 0; c < channels; ++c) {
+                    clip.tracks[c].push_back(frame[c]);
+                }
+                break;
+            case ChannelMode::MidSide:
+                clip.tracks[0].push_back(frame[0]);
+                clip.tracks[1].push_back(frame[1]);
+                clip.tracks[2].push_back((frame[0] + frame[1]) / 2.0);
+                clip.tracks[3].push_back((frame[0] - frame[1]) / 2.0);
+                break;
+        }
+    }
+}
+
+bool decodeAudioFile(const std::string& filename,
+                     const Spectrogram::Config& config,
+                     ChannelMode mode,
+                     AudioClip& clip,
+                     std::string& error) {
+    SF_INFO sfInfo;
+    memset(&sfInfo, 0, sizeof(sfInfo));
+    SNDFILE* sndFile = sf_open(filename.c_str(), SFM_READ, &sfInfo);
+    if (!sndFile) {
+        error = sf_strerror(nullptr);
+        return false;
+    }
+
+    const int channels = sfInfo.channels;
+    if (!initAudioClip(channels, sfInfo.samplerate, mode, clip, error)) {
+        sf_close(sndFile);
+        return false;
+    }
+
+    // 根据开始时间和持续时间确定读取范围
+    sf_count_t startFrame = static_cast<sf_count_t>(config.start_time * sfInfo.samplerate);
+    startFrame = std::clamp<sf_count_t>(startFrame, 0, sfInfo.frames);
+    sf_count_t numFrames = sfInfo.frames - startFrame;
+    if (config.duration > 0) {
+        numFrames = std::min(numFrames, static_cast<sf_count_t>(config.duration * sfInfo.samplerate));
+    }
+
+    if (startFrame > 0 && sf_seek(sndFile, startFrame, SEEK_SET) < 0) {
+        error = sf_strerror(sndFile);
+        sf_close(sndFile);
+        return false;
+    }
+
+    // 分块读取并拆分声道，避免一次性分配整段交错数据
+    const sf_count_t chunkFrames = 65536;
+    std::vector<double> buffer(chunkFrames * channels);
+    for (auto& track : clip.tracks) {
+        track.reserve(numFrames);
+    }
+
+    sf_count_t remaining = numFrames;
+    while (remaining > 0) {
+        sf_count_t got = sf_readf_double(sndFile, buffer.data(), std::min(chunkFrames, remaining));
+        if (got <= 0) break;
+        appendAudioFrames(buffer.data(), static_cast<size_t>(got), mode, clip);
+        remaining -= got;
+    }
+
+    sf_close(sndFile);
+    return true;
+}
+
+std::shared_ptr<const FftPlan> FftPlan::get(int fftSize) {
+    static std::map<int, std::shared_ptr<const FftPlan>> plans;
+    std::lock_guard<std::mutex> lock(fftwPlannerMutex());
+    auto& plan = plans[fftSize];
+    if (!plan) plan.reset(new FftPlan(fftSize));
+    return plan;
+}
+
+FftPlan::FftPlan(int fftSize)
+    : size(fftSize), window(fftSize) {
+    // 预先计算汉宁窗
+    for (int i = 0; i < fftSize; ++i) {
+        window[i] = 0.5 * (1 - std::cos(2 * M_PI * i / (fftSize - 1)));
+    }
+
+    // 调用者已持有 fftwPlannerMutex；规划时使用临时缓冲区，执行时由各分析器传入自己的缓冲区
+    double* in = fftw_alloc_real(fftSize);
+    fftw_complex* out = fftw_alloc_complex(fftSize / 2 + 1);
+    plan = fftw_plan_dft_r2c_1d(fftSize, in, out, FFTW_ESTIMATE);
+    fftw_free(in);
+    fftw_free(out);
+}
+
+FftPlan::~FftPlan() {
+    fftw_destroy_plan(plan);
+}
+
+StftAnalyzer::StftAnalyzer(int fftSize)
+    : fftSize(fftSize), fft(FftPlan::get(fftSize)) {
+    in = fftw_alloc_real(fftSize);
+    out = fftw_alloc_complex(fftSize / 2 + 1);
+}
+
+StftAnalyzer::~StftAnalyzer() {
+    fftw_free(in);
+    fftw_free(out);
+}
+
+void StftAnalyzer::transform(const double* samples, size_t count, long offset) {
+    const long size = static_cast<long>(count);
+    for (int i = 0; i < fftSize; ++i) {
+        long index = offset + i;
+        double sample = index >= 0 && index < size ? samples[index] : 0.0;
+        in[i] = sample * fft->window[i];
+    }
+    fftw_execute_dft_r2c(fft->plan, in, out);
+}
+
+double StftAnalyzer::binIntensity(int bin) const {
+    // 满刻度正弦波经汉宁窗后的峰值幅度为 fftSize/4
+    const double reference = fftSize / 4.0;
+    double magnitude = std::sqrt(out[bin][0] * out[bin][0] + out[bin][1] * out[bin][1]);
+    double db = 20 * std::log10(magnitude / reference + 1e-12);
+    return std::clamp((db + kDynamicRangeDb) / kDynamicRangeDb, 0.0, 1.0);
+}
+
+std::vector<std::vector<double>> StftAnalyzer::compute(const std::vector<double>& samples, int hopSize) {
+    return compute(samples.data(), samples.size(), hopSize);
+}
+
+std::vector<std::vector<double>> StftAnalyzer::compute(const double* samples, size_t count, int hopSize) {
+    const int numBins = fftSize / 2 + 1;
+    // 不足一个窗长的片段补零后按一帧处理
+    const size_t numFrames = count <= static_cast<size_t>(fftSize)
+        ? 1
+        : (count - fftSize) / hopSize + 1;
+
+    std::vector<std::vector<double>> specData(numFrames, std::vector<double>(numBins));
+    for (size_t frame = 0; frame < numFrames; ++frame) {
+        transform(samples, count, static_cast<long>(frame * hopSize));
+
+        std::vector<double>& column = specData[frame];
+        for (int k = 0; k < numBins; ++k) {
+            column[k] = binIntensity(k);
+        }
+    }
+
+    return specData;
+}
+
+Spectrogram::Band StftAnalyzer::computeBand(const std::vector<double>& samples, int sampleRate,
+                                            int hopSize, double minFreq, double maxFreq) {
+    return computeBand(samples.data(), samples.size(), sampleRate, hopSize, minFreq, maxFreq);
+}
+
+Spectrogram::Band StftAnalyzer::computeBand(const double* samples, size_t count, int sampleRate,
+                                            int hopSize, double minFreq, double maxFreq) {
+    const int lastBin = fftSize / 2;
+    const double binHz = static_cast<double>(sampleRate) / fftSize;
+
+    Spectrogram::Band band;
+    band.fft_size = fftSize;
+    band.hop_size = hopSize;
+    band.min_freq = minFreq;
+    band.max_freq = maxFreq;
+    band.first_bin = std::clamp(static_cast<int>(std::floor(minFreq / binHz)), 0, lastBin);
+    const int endBin = std::clamp(static_cast<int>(std::ceil(maxFreq / binHz)), band.first_bin, lastBin) + 1;
+
+    const size_t numFrames = std::max<size_t>(1, (count + hopSize - 1) / hopSize);
+
+    band.frames.assign(numFrames, std::vector<double>(endBin - band.first_bin));
+    for (size_t frame = 0; frame < numFrames; ++frame) {
+        transform(samples, count, static_cast<long>(frame * hopSize) - fftSize / 2);
+
+        std::vector<double>& column = band.frames[frame];
+        for (int k = band.first_bin; k < endBin; ++k) {
+            column[k - band.first_bin] = binIntensity(k);
+        }
+    }
+
+    return band;
+}
+
+std::vector<BandPlan> planBands(std::vector<int> fftSizes, int sampleRate, int baseHop,
+                                int referenceFft, double minFreq, double maxFreq) {
+    // 从长窗到短窗排列，长窗负责低频
+    std::sort(fftSizes.begin(), fftSizes.end(), std::greater<int>());
+    fftSizes.erase(std::unique(fftSizes.begin(), fftSizes.end()), fftSizes.end());
+
+    std::vector<BandPlan> plans;
+    double lower = minFreq;
+    for (size_t i = 0; i < fftSizes.size() && lower < maxFreq; ++i) {
+        double upper = i + 1 < fftSizes.size()
+            ? std::max(lower, kCyclesPerWindow * sampleRate / fftSizes[i + 1])
+            : maxFreq;
+        upper = std::min(upper, maxFreq);
+        if (upper <= lower) continue;
+
+        int ratio = std::max(1, fftSizes[i] / referenceFft);
+        plans.push_back({fftSizes[i], baseHop * ratio, lower, upper});
+        lower = upper;
+    }
+
+    // 最高频段包含上限本身
+    if (!plans.empty()) {
+        plans.back().max_freq = std::nextafter(maxFreq, 2 * maxFreq);
+    }
+    return plans;
+}
+
+StftAnalyzer& AnalyzerCache::get(int fftSize) {
+    auto& analyzer = analyzers[fftSize];
+    if (!analyzer) analyzer = std::make_unique<StftAnalyzer>(fftSize);
+    return *analyzer;
+}
+
+std::vector<Spectrogram::Band> AnalyzerCache::analyze(const std::vector<double>& samples,
+                                                      int sampleRate,
+                                                      const Spectrogram::Config& config,
+                                                      int fftSize,
+                                                      const std::vector<int>& resolutionFfts) {
+    return analyze(samples.data(), samples.size(), sampleRate, config, fftSize, resolutionFfts);
+}
+
+std::vector<Spectrogram::Band> AnalyzerCache::analyze(const double* samples,
+                                                      size_t count,
+                                                      int sampleRate,
+                                                      const Spectrogram::Config& config,
+                                                      int fftSize,
+                                                      const std::vector<int>& resolutionFfts) {
+    const int hopSize = std::max(1, sampleRate / config.samples_per_sec);
+    std::vector<Spectrogram::Band> bands;
+
+    if (NarrowBandAnalyzer::applies(config, sampleRate, fftSize)) {
+        if (!narrowBand) narrowBand = std::make_unique<NarrowBandAnalyzer>();
+        bands.push_back(narrowBand->compute(samples, count, sampleRate, hopSize, config, fftSize));
+        return bands;
+    }
+
+    if (resolutionFfts.empty()) {
+        Spectrogram::Band band;
+        band.fft_size = fftSize;
+        band.hop_size = hopSize;
+        band.frames = get(fftSize).compute(samples, count, hopSize);
+        bands.push_back(std::move(band));
+        return bands;
+    }
+
+    // 多分辨率：每个 FFT 大小只计算自己频段的帧和 bin
+    auto plans = planBands(resolutionFfts, sampleRate, hopSize, fftSize,
+                           config.min_freq, config.max_freq);
+    for (const BandPlan& plan : plans) {
+        bands.push_back(get(plan.fft_size).computeBand(
+            samples, count, sampleRate, plan.hop_size, plan.min_freq, plan.max_freq));
+    }
+    return bands;
+}
+
+std::vector<std::vector<Spectrogram::Band>> AnalyzerCache::analyze(const AudioClip& clip,
+                                                                   const Spectrogram::Config& config,
+                                                                   int fftSize,
+                                                                   const std::vector<int>& resolutionFfts,
+                                                                   int threads) {
+    const size_t numTracks = clip.tracks.size();
+    std::vector<std::vector<Spectrogram::Band>> result(numTracks);
+    const size_t numThreads = std::min(numTracks, static_cast<size_t>(std::max(1, threads)));
+
+    if (numThreads <= 1) {
+        for (size_t t = 0; t < numTracks; ++t) {
+            result[t] = analyze(clip.tracks[t], clip.sampleRate, config, fftSize, resolutionFfts);
+        }
+        return result;
+    }
+
+    // 各路信号并发计算；FFT 计划和窗表是共享的，每个线程只需要自己的缓冲区
+    std::atomic<size_t> next{0};
+    auto work = [&](AnalyzerCache& cache) {
+        for (size_t t = next++; t < numTracks; t = next++) {
+            result[t] = cache.analyze(clip.tracks[t], clip.sampleRate, config, fftSize, resolutionFfts);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < numThreads; ++i) {
+        workers.emplace_back([&] {
+            AnalyzerCache cache;
+            work(cache);
+        });
+    }
+    work(*this);
+    for (auto& worker : workers) worker.join();
+
+    return result;
+}
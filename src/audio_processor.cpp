@@ -1,98 +1,153 @@
 #include "audio_processor.hpp"
-#include <cmath>
-#include <stdexcept>
+#include <algorithm>
 
-AudioProcessor::AudioProcessor() {}
+namespace {
 
-AudioProcessor::~AudioProcessor() {}
+constexpr size_t kChunkFrames = 65536;
 
-bool AudioProcessor::loadAudioFile(const std::string& filename) {
-    SF_INFO sfinfo;
-    SNDFILE* file = sf_open(filename.c_str(), SFM_READ, &sfinfo);
-    
-    if (!file) {
+} // namespace
+
+AudioProcessor::AudioProcessor(const Options& options) : options(options) {}
+
+void AudioProcessor::selectRange(size_t frames, int sampleRate, size_t& first, size_t& count) const {
+    const Spectrogram::Config& config = options.spec;
+    double start = std::max(0.0, config.start_time * sampleRate);
+    first = std::min(frames, static_cast<size_t>(start));
+    count = frames - first;
+    if (config.duration > 0) {
+        count = std::min(count, static_cast<size_t>(config.duration * sampleRate));
+    }
+}
+
+bool AudioProcessor::analyzeFile(const std::string& filename, std::string& error) {
+    if (!decodeAudioFile(filename, options.spec, options.channel_mode, clip, error)) {
         return false;
     }
-    
-    sampleRate = sfinfo.samplerate;
-    channels = sfinfo.channels;
-    
-    // 读取所有采样点
-    std::vector<float> buffer(sfinfo.frames * sfinfo.channels);
-    sf_readf_float(file, buffer.data(), sfinfo.frames);
-    
-    // 如果是多声道，只取第一个声道
-    audioData.resize(sfinfo.frames);
-    for (sf_count_t i = 0; i < sfinfo.frames; ++i) {
-        audioData[i] = buffer[i * sfinfo.channels];
-    }
-    
-    sf_close(file);
+    sampleRate = clip.sampleRate;
+    trackNames = clip.trackNames;
+    tracks = analyzers.analyze(clip, options.spec, options.fft_size, options.resolution_ffts,
+                               options.threads);
     return true;
 }
 
-void AudioProcessor::applyHannWindow(std::vector<double>& window) {
-    for (size_t i = 0; i < window.size(); ++i) {
-        double multiplier = 0.5 * (1 - cos(2 * M_PI * i / (window.size() - 1)));
-        window[i] *= multiplier;
+bool AudioProcessor::previewFile(const std::string& filename, int width, std::string& error) {
+    if (!lazy.open(filename, options.spec, options.channel_mode, options.fft_size, error) ||
+        !lazy.preview(width, tracks, previewConfig, error)) {
+        return false;
     }
+    sampleRate = lazy.getSampleRate();
+    trackNames = lazy.getTrackNames();
+    return true;
 }
 
-std::vector<double> AudioProcessor::computeFFT(const std::vector<double>& window) {
-    int n = window.size();
-    fftw_complex* in = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * n);
-    fftw_complex* out = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * n);
-    
-    // Copy input data
-    for (int i = 0; i < n; i++) {
-        in[i][0] = window[i];
-        in[i][1] = 0.0;
-    }
-    
-    fftw_plan plan = fftw_plan_dft_1d(n, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-    fftw_execute(plan);
-    
-    std::vector<double> magnitudes(n/2 + 1);
-    for (int i = 0; i <= n/2; i++) {
-        double real = out[i][0];
-        double imag = out[i][1];
-        magnitudes[i] = sqrt(real*real + imag*imag);
-    }
-    
-    fftw_destroy_plan(plan);
-    fftw_free(in);
-    fftw_free(out);
-    
-    return magnitudes;
+bool AudioProcessor::refine(std::string& error) {
+    if (lazy.frameCount() == 0) {
+        error = "尚未生成预览";
+        return false;
+    }
+    if (!lazy.refine(error)) {
+        return false;
+    }
+    tracks = lazy.getTracks();
+    return true;
 }
 
-std::vector<std::vector<double>> AudioProcessor::computeSpectrogram(int windowSize, int hopSize) {
-    if (audioData.empty()) {
-        throw std::runtime_error("No audio data loaded");
-    }
-    
-    std::vector<std::vector<double>> spectrogram;
-    std::vector<double> window(windowSize);
-    
-    for (size_t i = 0; i + windowSize <= audioData.size(); i += hopSize) {
-        // Copy audio data to window
-        for (int j = 0; j < windowSize; ++j) {
-            window[j] = audioData[i + j];
-        }
-        
-        // Apply Hann window
-        applyHannWindow(window);
-        
-        // Compute FFT and add to spectrogram
-        auto magnitudes = computeFFT(window);
-        
-        // Convert to dB scale
-        for (auto& mag : magnitudes) {
-            mag = 20 * log10(mag + 1e-6);
-        }
-        
-        spectrogram.push_back(magnitudes);
-    }
-    
-    return spectrogram;
-} 
\ No newline at end of file
+bool AudioProcessor::analyzeSamples(const double* samples, size_t frames, int channels, int sampleRate,
+                                    std::string& error) {
+    if (sampleRate <= 0 || (!samples && frames > 0)) {
+        error = "无效的 PCM 缓冲区";
+        return false;
+    }
+    if (!initAudioClip(channels, sampleRate, options.channel_mode, clip, error)) {
+        return false;
+    }
+
+    size_t first, count;
+    selectRange(frames, sampleRate, first, count);
+    this->sampleRate = sampleRate;
+    trackNames = clip.trackNames;
+
+    // 单声道数据直接交给分析器
+    if (channels == 1 && options.channel_mode != ChannelMode::MidSide) {
+        tracks.assign(1, analyzers.analyze(samples + first, count, sampleRate, options.spec,
+                                           options.fft_size, options.resolution_ffts));
+        return true;
+    }
+
+    for (auto& track : clip.tracks) {
+        track.reserve(count);
+    }
+    appendAudioFrames(samples + first * channels, count, options.channel_mode, clip);
+    tracks = analyzers.analyze(clip, options.spec, options.fft_size, options.resolution_ffts,
+                               options.threads);
+    return true;
+}
+
+bool AudioProcessor::analyzeSamples(const float* samples, size_t frames, int channels, int sampleRate,
+                                    std::string& error) {
+    if (sampleRate <= 0 || (!samples && frames > 0)) {
+        error = "无效的 PCM 缓冲区";
+        return false;
+    }
+    if (!initAudioClip(channels, sampleRate, options.channel_mode, clip, error)) {
+        return false;
+    }
+
+    size_t first, count;
+    selectRange(frames, sampleRate, first, count);
+    this->sampleRate = sampleRate;
+    trackNames = clip.trackNames;
+
+    // 分块转换为 double 后拆分声道
+    for (auto& track : clip.tracks) {
+        track.reserve(count);
+    }
+    convertBuffer.resize(std::min(count, kChunkFrames) * channels);
+    const float* source = samples + first * channels;
+    for (size_t done = 0; done < count; ) {
+        size_t chunk = std::min(kChunkFrames, count - done);
+        std::copy(source + done * channels, source + (done + chunk) * channels, convertBuffer.begin());
+        appendAudioFrames(convertBuffer.data(), chunk, options.channel_mode, clip);
+        done += chunk;
+    }
+
+    tracks = analyzers.analyze(clip, options.spec, options.fft_size, options.resolution_ffts,
+                               options.threads);
+    return true;
+}
+
+bool AudioProcessor::render(unsigned char* pixels, int width, int height, size_t stride,
+                            std::string& error) {
+    if (!pixels || width <= 0 || height <= 0 || stride < static_cast<size_t>(width) * 3) {
+        error = "无效的图像缓冲区";
+        return false;
+    }
+    if (sampleRate <= 0) {
+        error = "尚未分析任何音频";
+        return false;
+    }
+    spectrogram.renderTracks(tracks, sampleRate, options.spec, width, height, pixels, stride);
+    return true;
+}
+
+bool AudioProcessor::render(std::vector<unsigned char>& pixels, int width, int height,
+                            std::string& error) {
+    if (width <= 0 || height <= 0) {
+        error = "无效的图像尺寸";
+        return false;
+    }
+    pixels.resize(static_cast<size_t>(width) * height * 3);
+    return render(pixels.data(), width, height, static_cast<size_t>(width) * 3, error);
+}
+
+bool AudioProcessor::encodePng(std::vector<unsigned char>& png, std::string& error) {
+    if (sampleRate <= 0) {
+        error = "尚未分析任何音频";
+        return false;
+    }
+    if (!spectrogram.encodeSpectrogram(tracks, sampleRate, options.spec, png)) {
+        error = "PNG 编码失败";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,605 @@
+#include "fingerprint.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <queue>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr double kPeakMinFreq = 100.0;      // 取峰的频率范围（Hz）
+constexpr double kPeakMaxFreq = 5000.0;
+constexpr int kPeakBands = 6;               // 对数等分的取峰频带数
+constexpr int kStepsPerOctave = 48;         // 频率量化：四分之一半音
+constexpr uint32_t kGroupUnits = 5;         // 每 50 ms 每个频带取一个峰
+constexpr double kMinIntensity = 0.5;       // 低于满刻度 40 dB 的峰忽略
+constexpr double kMinRise = 0.25;           // 至少上升 20 dB
+constexpr int kFanOut = 3;                  // 每个锚点配对的峰数
+constexpr uint32_t kMaxDelta = 100;         // 配对的最大时间差（10 ms）
+constexpr int kMaxFreqDelta = 127;          // 配对的最大频率差（四分之一半音）
+constexpr size_t kMergeFactor = 4;          // 同一大小级别的段达到该数量时合并
+
+const char kPrintMagic[8] = {'M', 'S', 'A', 'F', 'P', '1', 0, 0};
+const char kSegmentMagic[8] = {'M', 'S', 'A', 'S', 'E', 'G', '1', 0};
+const char kManifestMagic[8] = {'M', 'S', 'A', 'M', 'A', 'N', '1', 0};
+
+struct Peak {
+    uint32_t time;
+    int freq;
+    double rise;
+};
+
+uint32_t makeHash(int freq, int freqDelta, uint32_t delta) {
+    return (static_cast<uint32_t>(freq) & 0x1FF) << 15 |
+           (static_cast<uint32_t>(freqDelta + 128) & 0xFF) << 7 |
+           (delta & 0x7F);
+}
+
+std::string absolutePath(const std::string& path) {
+    std::error_code ec;
+    fs::path result = fs::absolute(path, ec);
+    return (ec ? fs::path(path) : result).lexically_normal().string();
+}
+
+bool fileStat(const std::string& path, uint64_t& size, int64_t& mtime) {
+    std::error_code ec;
+    size = fs::file_size(path, ec);
+    if (ec) return false;
+    auto time = fs::last_write_time(path, ec);
+    if (ec) return false;
+    mtime = static_cast<int64_t>(time.time_since_epoch().count());
+    return true;
+}
+
+// 先写临时文件再改名，避免中断时留下不完整的文件
+bool writeFileAtomically(const std::string& path, const char* magic, const void* data, uint64_t count,
+                         size_t itemSize, std::string& error) {
+    const std::string temp = path + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(magic, 8);
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(count * itemSize));
+        if (!out) {
+            error = "写入索引失败: " + temp;
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(temp, path, ec);
+    if (ec) {
+        error = "写入索引失败: " + ec.message();
+        return false;
+    }
+    return true;
+}
+
+// 段的大小级别：记录数每增加到 kMergeFactor 倍升一级
+int segmentTier(size_t count) {
+    int tier = 0;
+    while (count >= kMergeFactor) {
+        count /= kMergeFactor;
+        ++tier;
+    }
+    return tier;
+}
+
+// segments/ 下以序号命名的段文件
+std::vector<uint64_t> listSegmentFiles(const fs::path& directory) {
+    std::vector<uint64_t> numbers;
+    std::error_code ec;
+    for (const auto& item : fs::directory_iterator(directory, ec)) {
+        const std::string name = item.path().filename().string();
+        if (name.empty() || name.size() > 19 || name.find_first_not_of("0123456789") != std::string::npos) continue;
+        numbers.push_back(std::stoull(name));
+    }
+    std::sort(numbers.begin(), numbers.end());
+    return numbers;
+}
+
+// 清单：已写入倒排段的文件数，其后为有效段的序号
+bool readManifest(const std::string& path, uint64_t& files, std::vector<uint64_t>& numbers) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[8];
+    uint64_t count = 0;
+    in.read(magic, 8);
+    in.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!in || memcmp(magic, kManifestMagic, 8) != 0 || count == 0 || count > (1u << 20)) return false;
+    std::vector<uint64_t> items(count);
+    in.read(reinterpret_cast<char*>(items.data()), static_cast<std::streamsize>(count * sizeof(uint64_t)));
+    if (!in) return false;
+    files = items[0];
+    numbers.assign(items.begin() + 1, items.end());
+    return true;
+}
+
+} // namespace
+
+std::vector<FingerprintHash> computeFingerprint(const Spectrogram::Track& track, int sampleRate) {
+    const double maxFreq = std::min(kPeakMaxFreq, sampleRate / 2.0);
+    const double logMin = std::log2(kPeakMinFreq);
+    const double logMax = std::log2(maxFreq);
+
+    // 每 50 ms 每个取峰频带中能量上升最快的峰
+    std::map<uint64_t, Peak> strongest;
+    for (const Spectrogram::Band& band : track) {
+        // 窄带分析只覆盖很窄的范围，不参与指纹
+        if (band.frames.empty() || !band.freqs.empty()) continue;
+        const double binHz = static_cast<double>(sampleRate) / band.fft_size;
+        const int numBins = static_cast<int>(band.frames[0].size());
+
+        for (int p = 0; p < kPeakBands; ++p) {
+            double lo = std::max({std::exp2(logMin + (logMax - logMin) * p / kPeakBands), band.min_freq});
+            double hi = std::min({std::exp2(logMin + (logMax - logMin) * (p + 1) / kPeakBands), band.max_freq});
+            int firstBin = std::max(0, static_cast<int>(std::ceil(lo / binHz)) - band.first_bin);
+            int endBin = std::min(numBins, static_cast<int>(std::ceil(hi / binHz)) - band.first_bin);
+            if (firstBin >= endBin) continue;
+
+            // 频带内最强的频点相对半个窗长之前的上升量；窗内帧相互重叠，间隔半个窗长时上升才明显。
+            // 强度是对数刻度，上升量与音量无关，持续音的平台不产生峰
+            const size_t lag = std::max<size_t>(1, (band.fft_size / 2 + band.hop_size - 1) / band.hop_size);
+            for (size_t i = lag; i < band.frames.size(); ++i) {
+                const std::vector<double>& frame = band.frames[i];
+                const std::vector<double>& previous = band.frames[i - lag];
+                int bin = static_cast<int>(std::max_element(frame.begin() + firstBin, frame.begin() + endBin) -
+                                           frame.begin());
+                double rise = frame[bin] - previous[bin];
+                if (frame[bin] < kMinIntensity || rise < kMinRise) continue;
+
+                double freq = (bin + band.first_bin) * binHz;
+                uint32_t time = static_cast<uint32_t>(std::lround(100.0 * i * band.hop_size / sampleRate));
+                uint64_t key = static_cast<uint64_t>(time / kGroupUnits) * kPeakBands + p;
+                auto found = strongest.find(key);
+                if (found == strongest.end() || found->second.rise < rise) {
+                    int step = static_cast<int>(std::lround(kStepsPerOctave * std::log2(freq / kPeakMinFreq)));
+                    strongest[key] = {time, step, rise};
+                }
+            }
+        }
+    }
+
+    std::vector<Peak> peaks;
+    peaks.reserve(strongest.size());
+    for (const auto& item : strongest) {
+        peaks.push_back(item.second);
+    }
+    std::sort(peaks.begin(), peaks.end(), [](const Peak& a, const Peak& b) {
+        return a.time != b.time ? a.time < b.time : a.freq < b.freq;
+    });
+
+    // 每个峰与其后时间差在 (0, kMaxDelta] 内的前几个峰配对
+    std::vector<FingerprintHash> hashes;
+    for (size_t i = 0; i < peaks.size(); ++i) {
+        int paired = 0;
+        for (size_t j = i + 1; j < peaks.size() && paired < kFanOut; ++j) {
+            uint32_t delta = peaks[j].time - peaks[i].time;
+            if (delta == 0) continue;
+            if (delta > kMaxDelta) break;
+            int freqDelta = peaks[j].freq - peaks[i].freq;
+            if (std::abs(freqDelta) > kMaxFreqDelta) continue;
+            hashes.push_back({makeHash(peaks[i].freq, freqDelta, delta), peaks[i].time});
+            ++paired;
+        }
+    }
+    return hashes;
+}
+
+FingerprintIndex::~FingerprintIndex() {
+    unmapAll();
+}
+
+void FingerprintIndex::unmapAll() {
+    for (Segment& segment : segments) {
+        if (segment.mapping) munmap(segment.mapping, segment.mappedBytes);
+    }
+    segments.clear();
+}
+
+bool FingerprintIndex::open(const std::string& directory, std::string& error) {
+    unmapAll();
+    entries.clear();
+    byPath.clear();
+    nextSegment = 0;
+    this->directory = directory;
+
+    std::error_code ec;
+    fs::create_directories(fs::path(directory) / "prints", ec);
+    fs::create_directories(fs::path(directory) / "segments", ec);
+    if (ec) {
+        error = "无法创建索引目录: " + ec.message();
+        return false;
+    }
+
+    std::ifstream files(fs::path(directory) / "files.tsv");
+    std::string line;
+    while (std::getline(files, line)) {
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, '\t')) {
+            fields.push_back(field);
+        }
+        // 早期的索引没有渲染选项摘要和时长，这些条目的图像不会被复用
+        if (fields.size() < 6 || fields.size() > 8) continue;
+
+        Entry entry;
+        try {
+            entry.id = static_cast<uint32_t>(std::stoul(fields[0]));
+            entry.size = std::stoull(fields[1]);
+            entry.mtime = std::stoll(fields[2]);
+            entry.hash_count = static_cast<uint32_t>(std::stoul(fields[3]));
+            if (fields.size() == 8) entry.duration = std::stod(fields[7]);
+        } catch (const std::exception&) {
+            continue;
+        }
+        if (entry.id != entries.size()) continue;
+        entry.input_file = fields[4];
+        entry.output_file = fields[5];
+        if (fields.size() >= 7) entry.options = fields[6];
+        byPath[entry.input_file] = entries.size();
+        entries.push_back(entry);
+    }
+
+    // 只加载清单中的段；不在清单中的段是写入或合并中断留下的，删除
+    const fs::path segmentDir = fs::path(directory) / "segments";
+    const std::vector<uint64_t> existing = listSegmentFiles(segmentDir);
+    if (!existing.empty()) nextSegment = existing.back() + 1;
+    uint64_t indexedFiles = 0;
+    std::vector<uint64_t> numbers;
+    if (fs::exists(segmentDir / "MANIFEST")) {
+        if (!readManifest((segmentDir / "MANIFEST").string(), indexedFiles, numbers)) {
+            error = "索引清单已损坏: " + (segmentDir / "MANIFEST").string();
+            return false;
+        }
+    } else {
+        // 没有清单的旧索引：目录中的段全部有效
+        numbers = existing;
+        indexedFiles = entries.size();
+    }
+    if (indexedFiles > entries.size()) {
+        error = "索引清单与 files.tsv 不一致: " + directory;
+        return false;
+    }
+    for (uint64_t number : numbers) {
+        if (!mapSegment(number, error)) return false;
+        nextSegment = std::max(nextSegment, number + 1);
+    }
+    for (uint64_t number : existing) {
+        if (std::find(numbers.begin(), numbers.end(), number) == numbers.end()) {
+            fs::remove(segmentDir / std::to_string(number), ec);
+        }
+    }
+
+    // 已登记但清单尚未记录其倒排段的文件（登记后写清单前中断），从保存的指纹重建
+    std::vector<Posting> postings;
+    for (size_t id = indexedFiles; id < entries.size(); ++id) {
+        std::vector<FingerprintHash> hashes;
+        if (!loadFingerprint(entries[id], hashes, error)) return false;
+        for (const FingerprintHash& hash : hashes) {
+            postings.push_back({hash.hash, static_cast<uint32_t>(id), hash.time});
+        }
+    }
+    if (!postings.empty()) return appendSegment(postings, error);
+    if (indexedFiles < entries.size() || !fs::exists(segmentDir / "MANIFEST")) return writeManifest(numbers, error);
+    return true;
+}
+
+std::string FingerprintIndex::segmentPath(uint64_t number) const {
+    return (fs::path(directory) / "segments" / std::to_string(number)).string();
+}
+
+bool FingerprintIndex::writeManifest(const std::vector<uint64_t>& numbers, std::string& error) {
+    std::vector<uint64_t> items;
+    items.push_back(entries.size());
+    items.insert(items.end(), numbers.begin(), numbers.end());
+    return writeFileAtomically((fs::path(directory) / "segments" / "MANIFEST").string(), kManifestMagic,
+                               items.data(), items.size(), sizeof(uint64_t), error);
+}
+
+bool FingerprintIndex::mapSegment(uint64_t number, std::string& error) {
+    const std::string path = segmentPath(number);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) ::close(fd);
+        error = "无法读取索引段: " + path;
+        return false;
+    }
+
+    Segment segment;
+    segment.number = number;
+    segment.mappedBytes = static_cast<size_t>(info.st_size);
+    if (segment.mappedBytes >= 16) {
+        segment.mapping = mmap(nullptr, segment.mappedBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (!segment.mapping || segment.mapping == MAP_FAILED) {
+        error = "无法映射索引段: " + path;
+        return false;
+    }
+
+    const char* bytes = static_cast<const char*>(segment.mapping);
+    uint64_t count;
+    memcpy(&count, bytes + 8, sizeof(count));
+    if (memcmp(bytes, kSegmentMagic, 8) != 0 || 16 + count * sizeof(Posting) != segment.mappedBytes) {
+        munmap(segment.mapping, segment.mappedBytes);
+        error = "索引段已损坏: " + path;
+        return false;
+    }
+    segment.postings = reinterpret_cast<const Posting*>(bytes + 16);
+    segment.count = static_cast<size_t>(count);
+    segments.push_back(segment);
+    return true;
+}
+
+bool FingerprintIndex::appendSegment(std::vector<Posting>& postings, std::string& error) {
+    std::sort(postings.begin(), postings.end(), [](const Posting& a, const Posting& b) {
+        return a.hash != b.hash ? a.hash < b.hash : a.time < b.time;
+    });
+    const uint64_t number = nextSegment++;
+    if (!writeFileAtomically(segmentPath(number), kSegmentMagic, postings.data(), postings.size(),
+                             sizeof(Posting), error)) {
+        return false;
+    }
+
+    // 新段写入清单后才生效，清单更新前中断时下次打开会删除该段
+    std::vector<uint64_t> numbers;
+    for (const Segment& segment : segments) numbers.push_back(segment.number);
+    numbers.push_back(number);
+    if (!writeManifest(numbers, error)) {
+        std::error_code ec;
+        fs::remove(segmentPath(number), ec);
+        return false;
+    }
+    return mapSegment(number, error);
+}
+
+const FingerprintIndex::Entry* FingerprintIndex::find(const std::string& path) const {
+    auto found = byPath.find(absolutePath(path));
+    return found == byPath.end() ? nullptr : &entries[found->second];
+}
+
+bool FingerprintIndex::unchanged(const Entry& entry) const {
+    uint64_t size;
+    int64_t mtime;
+    return fileStat(entry.input_file, size, mtime) && size == entry.size && mtime == entry.mtime;
+}
+
+bool FingerprintIndex::loadFingerprint(const Entry& entry, std::vector<FingerprintHash>& hashes,
+                                       std::string& error) const {
+    std::ifstream in(fs::path(directory) / "prints" / std::to_string(entry.id), std::ios::binary);
+    char magic[8];
+    uint64_t count = 0;
+    in.read(magic, 8);
+    in.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!in || memcmp(magic, kPrintMagic, 8) != 0 || count != entry.hash_count) {
+        error = "指纹文件已损坏: " + entry.input_file;
+        return false;
+    }
+    hashes.resize(count);
+    in.read(reinterpret_cast<char*>(hashes.data()), static_cast<std::streamsize>(count * sizeof(FingerprintHash)));
+    if (!in) {
+        error = "指纹文件已损坏: " + entry.input_file;
+        return false;
+    }
+    return true;
+}
+
+std::vector<FingerprintIndex::Match> FingerprintIndex::query(const std::vector<FingerprintHash>& hashes,
+                                                             size_t maxResults,
+                                                             int64_t excludeId) const {
+    // 起始时间在不同的分帧下可能相差一帧，因此同时查找两峰时间差相差 1 的哈希
+    auto forEachPosting = [&](const FingerprintHash& query, auto visit) {
+        const uint32_t delta = query.hash & 0x7F;
+        for (uint32_t variant = std::max(delta, 2u) - 1; variant <= std::min(delta + 1, kMaxDelta); ++variant) {
+            const uint32_t hash = (query.hash & ~0x7Fu) | variant;
+            for (const Segment& segment : segments) {
+                const Posting* end = segment.postings + segment.count;
+                const Posting* posting = std::lower_bound(segment.postings, end, hash,
+                    [](const Posting& p, uint32_t hash) { return p.hash < hash; });
+                for (; posting != end && posting->hash == hash; ++posting) {
+                    if (posting->file >= entries.size() || posting->file == excludeId) continue;
+                    visit(posting->file, static_cast<int64_t>(posting->time) - query.time);
+                }
+            }
+        }
+    };
+
+    // 按 (文件, 时间差) 投票，同一段录音的相同哈希时间差一致
+    std::unordered_map<uint64_t, uint32_t> votes;
+    for (const FingerprintHash& query : hashes) {
+        forEachPosting(query, [&](uint32_t file, int64_t offset) {
+            ++votes[static_cast<uint64_t>(file) << 32 | static_cast<uint32_t>(offset + (1ll << 31))];
+        });
+    }
+
+    // 相邻的时间差合并计数，容忍 10 ms 的量化误差
+    std::unordered_map<uint32_t, std::pair<uint32_t, int64_t>> best;
+    for (const auto& vote : votes) {
+        uint32_t count = vote.second;
+        for (int d : {-1, 1}) {
+            auto neighbour = votes.find(vote.first + d);
+            if (neighbour != votes.end()) count += neighbour->second;
+        }
+        uint32_t file = static_cast<uint32_t>(vote.first >> 32);
+        int64_t offset = static_cast<int64_t>(vote.first & 0xFFFFFFFFu) - (1ll << 31);
+        auto& current = best[file];
+        if (count > current.first) current = {count, offset};
+    }
+
+    // 投票中一个查询哈希可能经由相邻的变体和时间差计入多次，
+    // 相似度按与最佳时间差一致的不同查询哈希计数，不超过双方的哈希数
+    std::unordered_map<uint32_t, uint32_t> aligned;
+    std::vector<uint32_t> counted;
+    for (const FingerprintHash& query : hashes) {
+        counted.clear();
+        forEachPosting(query, [&](uint32_t file, int64_t offset) {
+            auto found = best.find(file);
+            if (found == best.end() || std::abs(offset - found->second.second) > 1) return;
+            if (std::find(counted.begin(), counted.end(), file) != counted.end()) return;
+            counted.push_back(file);
+            ++aligned[file];
+        });
+    }
+
+    std::vector<Match> matches;
+    for (const auto& item : best) {
+        const Entry& entry = entries[item.first];
+        // 重新索引过的文件只保留最新的条目
+        if (byPath.at(entry.input_file) != item.first) continue;
+        const double count = aligned[item.first];
+        size_t shorter = std::max<size_t>(1, std::min<size_t>(hashes.size(), entry.hash_count));
+        size_t longer = std::max<size_t>(1, std::max<size_t>(hashes.size(), entry.hash_count));
+        Match match;
+        match.entry = &entry;
+        match.similarity = std::min(1.0, count / longer);
+        match.coverage = std::min(1.0, count / shorter);
+        match.offset = item.second.second / 100.0;
+        matches.push_back(match);
+    }
+    std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+        return a.similarity > b.similarity;
+    });
+    if (matches.size() > maxResults) matches.resize(maxResults);
+    return matches;
+}
+
+bool FingerprintIndex::add(const std::string& inputFile,
+                           const std::string& outputFile,
+                           const std::string& options,
+                           const std::vector<FingerprintHash>& hashes,
+                           double duration,
+                           std::string& error) {
+    Entry entry;
+    entry.id = static_cast<uint32_t>(entries.size());
+    entry.input_file = absolutePath(inputFile);
+    entry.output_file = absolutePath(outputFile);
+    entry.options = options;
+    entry.hash_count = static_cast<uint32_t>(hashes.size());
+    entry.duration = duration;
+    // files.tsv 以制表符和换行分隔字段
+    for (const std::string* field : {&entry.input_file, &entry.output_file, &entry.options}) {
+        if (field->find_first_of("\t\r\n") != std::string::npos) {
+            error = "路径中含有制表符或换行符，无法写入索引: " + *field;
+            return false;
+        }
+    }
+    if (!fileStat(entry.input_file, entry.size, entry.mtime)) {
+        error = "无法读取文件信息: " + inputFile;
+        return false;
+    }
+
+    // 先写指纹再登记文件，中断时不会出现引用不存在数据的条目
+    const std::string printPath = (fs::path(directory) / "prints" / std::to_string(entry.id)).string();
+    if (!writeFileAtomically(printPath, kPrintMagic, hashes.data(), hashes.size(), sizeof(FingerprintHash), error)) {
+        return false;
+    }
+
+    // 倒排段在登记之后才写入清单，两步之间中断时下次打开从指纹文件重建
+    std::ofstream files(fs::path(directory) / "files.tsv", std::ios::app);
+    files << entry.id << '\t' << entry.size << '\t' << entry.mtime << '\t' << entry.hash_count << '\t'
+          << entry.input_file << '\t' << entry.output_file << '\t' << entry.options << '\t'
+          << entry.duration << '\n';
+    if (!files.flush()) {
+        error = "写入索引失败: files.tsv";
+        return false;
+    }
+    byPath[entry.input_file] = entries.size();
+    entries.push_back(entry);
+
+    std::vector<Posting> postings;
+    postings.reserve(hashes.size());
+    for (const FingerprintHash& hash : hashes) {
+        postings.push_back({hash.hash, entry.id, hash.time});
+    }
+    return appendSegment(postings, error) && mergeSegments(error);
+}
+
+bool FingerprintIndex::mergeSegments(std::string& error) {
+    // 大小相近的段凑满 kMergeFactor 个才合并，每条记录只在升级时被重写，总写入量为 O(n log n)
+    while (true) {
+        std::map<int, std::vector<size_t>> tiers;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            tiers[segmentTier(segments[i].count)].push_back(i);
+        }
+        auto full = std::find_if(tiers.begin(), tiers.end(), [](const auto& tier) {
+            return tier.second.size() >= kMergeFactor;
+        });
+        if (full == tiers.end()) return true;
+        if (!mergeSegments(full->second, error)) return false;
+    }
+}
+
+bool FingerprintIndex::mergeSegments(const std::vector<size_t>& selected, std::string& error) {
+    // 多路归并选中的段，输出按哈希排序的单个段
+    const uint64_t number = nextSegment++;
+    const std::string path = segmentPath(number);
+    const std::string temp = path + ".tmp";
+    FILE* out = fopen(temp.c_str(), "wb");
+    if (!out) {
+        error = "无法写入索引段: " + temp;
+        return false;
+    }
+
+    uint64_t total = 0;
+    for (size_t i : selected) total += segments[i].count;
+    bool ok = fwrite(kSegmentMagic, 1, 8, out) == 8 && fwrite(&total, sizeof(total), 1, out) == 1;
+
+    using Cursor = std::pair<const Posting*, const Posting*>;
+    auto later = [](const Cursor& a, const Cursor& b) {
+        return a.first->hash != b.first->hash ? a.first->hash > b.first->hash : a.first->time > b.first->time;
+    };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(later)> heap(later);
+    for (size_t i : selected) {
+        const Segment& segment = segments[i];
+        if (segment.count > 0) heap.push({segment.postings, segment.postings + segment.count});
+    }
+    while (ok && !heap.empty()) {
+        Cursor cursor = heap.top();
+        heap.pop();
+        ok = fwrite(cursor.first, sizeof(Posting), 1, out) == 1;
+        if (++cursor.first != cursor.second) heap.push(cursor);
+    }
+    if (fclose(out) != 0) ok = false;
+    std::error_code ec;
+    if (ok) fs::rename(temp, path, ec);
+    if (!ok || ec) {
+        fs::remove(temp, ec);
+        error = "写入索引段失败: " + path;
+        return false;
+    }
+
+    // 清单切换到新段是合并的提交点：之前中断时旧段仍然有效，之后中断时旧段在下次打开时删除
+    std::vector<uint64_t> numbers;
+    std::vector<Segment> kept;
+    std::vector<Segment> merged;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        if (std::find(selected.begin(), selected.end(), i) == selected.end()) {
+            numbers.push_back(segments[i].number);
+            kept.push_back(segments[i]);
+        } else {
+            merged.push_back(segments[i]);
+        }
+    }
+    numbers.push_back(number);
+    if (!writeManifest(numbers, error)) {
+        fs::remove(path, ec);
+        return false;
+    }
+
+    segments.swap(kept);
+    for (const Segment& segment : merged) {
+        munmap(segment.mapping, segment.mappedBytes);
+        fs::remove(segmentPath(segment.number), ec);
+    }
+    return mapSegment(number, error);
+}
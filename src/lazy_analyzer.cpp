@@ -0,0 +1,214 @@
+#include "lazy_analyzer.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr sf_count_t kChunkFrames = 65536;
+
+} // namespace
+
+LazyAnalyzer::~LazyAnalyzer() {
+    close();
+}
+
+void LazyAnalyzer::close() {
+    if (file) {
+        sf_close(file);
+        file = nullptr;
+    }
+}
+
+bool LazyAnalyzer::open(const std::string& filename,
+                        const Spectrogram::Config& config,
+                        ChannelMode mode,
+                        int fftSize,
+                        std::string& error) {
+    close();
+    memset(&info, 0, sizeof(info));
+    file = sf_open(filename.c_str(), SFM_READ, &info);
+    if (!file) {
+        error = sf_strerror(nullptr);
+        return false;
+    }
+    if (!initAudioClip(info.channels, info.samplerate, mode, window, error)) {
+        close();
+        return false;
+    }
+
+    this->filename = filename;
+    this->config = config;
+    this->mode = mode;
+    this->fftSize = fftSize;
+    position = 0;
+
+    // 与 decodeAudioFile 相同的读取范围
+    startFrame = std::clamp<sf_count_t>(static_cast<sf_count_t>(config.start_time * info.samplerate),
+                                        0, info.frames);
+    numSamples = info.frames - startFrame;
+    if (config.duration > 0) {
+        numSamples = std::min(numSamples, static_cast<sf_count_t>(config.duration * info.samplerate));
+    }
+
+    // 与 StftAnalyzer::compute 相同的分帧方式
+    hopSize = std::max(1, info.samplerate / config.samples_per_sec);
+    numFrames = numSamples <= fftSize ? 1 : static_cast<size_t>(numSamples - fftSize) / hopSize + 1;
+    numComputed = 0;
+
+    if (!analyzer || analyzer->getFftSize() != fftSize) {
+        analyzer = std::make_unique<StftAnalyzer>(fftSize);
+    }
+
+    // 只记录频段参数，帧在计算后才保存
+    sparseFrames.assign(window.trackNames.size(), std::map<size_t, std::vector<double>>());
+    tracks.assign(window.trackNames.size(), Spectrogram::Track(1));
+    for (auto& track : tracks) {
+        Spectrogram::Band& band = track[0];
+        band.fft_size = fftSize;
+        band.hop_size = hopSize;
+    }
+    return true;
+}
+
+bool LazyAnalyzer::readWindow(sf_count_t offset, sf_count_t count, std::string& error) {
+    const sf_count_t target = startFrame + offset;
+    if (target != position) {
+        if (info.seekable) {
+            if (sf_seek(file, target, SEEK_SET) < 0) {
+                error = sf_strerror(file);
+                return false;
+            }
+            position = target;
+        } else if (target < position) {
+            // 不能定位的格式只能从头重新读取
+            close();
+            file = sf_open(filename.c_str(), SFM_READ, &info);
+            if (!file) {
+                error = sf_strerror(nullptr);
+                return false;
+            }
+            position = 0;
+        }
+    }
+
+    buffer.resize(std::min(kChunkFrames, std::max<sf_count_t>(count, 1)) * info.channels);
+    const sf_count_t chunkFrames = static_cast<sf_count_t>(buffer.size()) / info.channels;
+
+    // 不能定位时逐块读过中间的采样
+    while (position < target) {
+        sf_count_t got = sf_readf_double(file, buffer.data(), std::min(chunkFrames, target - position));
+        if (got <= 0) break;
+        position += got;
+    }
+
+    initAudioClip(info.channels, info.samplerate, mode, window, error);
+    for (auto& track : window.tracks) {
+        track.reserve(count);
+    }
+    sf_count_t remaining = count;
+    while (remaining > 0) {
+        sf_count_t got = sf_readf_double(file, buffer.data(), std::min(chunkFrames, remaining));
+        if (got <= 0) break;
+        appendAudioFrames(buffer.data(), static_cast<size_t>(got), mode, window);
+        position += got;
+        remaining -= got;
+    }
+    return true;
+}
+
+bool LazyAnalyzer::isComputed(size_t frame) const {
+    const auto& frames = tracks[0][0].frames;
+    return frames.empty() ? sparseFrames[0].count(frame) > 0 : !frames[frame].empty();
+}
+
+void LazyAnalyzer::computeFrame(size_t frame, size_t base) {
+    for (size_t t = 0; t < tracks.size(); ++t) {
+        const std::vector<double>& samples = window.tracks[t];
+        size_t count = std::min(samples.size() - std::min(base, samples.size()), static_cast<size_t>(fftSize));
+        // 不超过一个窗长的输入恰好产生一帧，越界部分补零
+        std::vector<double> result = std::move(analyzer->compute(samples.data() + base, count, hopSize)[0]);
+        auto& frames = tracks[t][0].frames;
+        if (frames.empty()) {
+            sparseFrames[t][frame] = std::move(result);
+        } else {
+            frames[frame] = std::move(result);
+        }
+    }
+    ++numComputed;
+}
+
+bool LazyAnalyzer::computeFrames(size_t step, std::string& error) {
+    if (!file) {
+        error = "尚未打开音频文件";
+        return false;
+    }
+
+    bool pending = false;
+    for (size_t frame = 0; frame < numFrames && !pending; frame += step) {
+        pending = !isComputed(frame);
+    }
+    if (!pending) return true;
+
+    // 相邻的帧有重叠时顺序读取整个片段，否则只读取每一帧的窗口
+    if (step * hopSize < static_cast<size_t>(fftSize)) {
+        if (!readWindow(0, numSamples, error)) return false;
+        for (size_t frame = 0; frame < numFrames; frame += step) {
+            if (!isComputed(frame)) computeFrame(frame, frame * hopSize);
+        }
+        window.tracks.assign(window.tracks.size(), std::vector<double>());
+        return true;
+    }
+
+    for (size_t frame = 0; frame < numFrames; frame += step) {
+        if (isComputed(frame)) continue;
+        sf_count_t offset = static_cast<sf_count_t>(frame * hopSize);
+        if (!readWindow(offset, std::min<sf_count_t>(fftSize, numSamples - offset), error)) return false;
+        computeFrame(frame, 0);
+    }
+    return true;
+}
+
+bool LazyAnalyzer::preview(int width,
+                           std::vector<Spectrogram::Track>& previewTracks,
+                           Spectrogram::Config& previewConfig,
+                           std::string& error) {
+    const size_t columns = static_cast<size_t>(std::max(1, width));
+    const size_t step = std::max<size_t>(1, (numFrames + columns - 1) / columns);
+    if (!computeFrames(step, error)) return false;
+
+    // 每列一帧，帧间隔按原来的 hopSize 标注，使第 x 列对应第 x 个预览帧
+    previewTracks.assign(tracks.size(), Spectrogram::Track(1));
+    for (size_t t = 0; t < tracks.size(); ++t) {
+        Spectrogram::Band& band = previewTracks[t][0];
+        band.fft_size = fftSize;
+        band.hop_size = hopSize;
+        band.frames.clear();
+        for (size_t frame = 0; frame < numFrames; frame += step) {
+            const auto& frames = tracks[t][0].frames;
+            band.frames.push_back(frames.empty() ? sparseFrames[t].at(frame) : frames[frame]);
+        }
+    }
+
+    previewConfig = config;
+    previewConfig.width = static_cast<int>((numFrames + step - 1) / step);
+    return true;
+}
+
+bool LazyAnalyzer::refine(std::string& error) {
+    if (!file) {
+        error = "尚未打开音频文件";
+        return false;
+    }
+
+    // 分配完整的结果并移入预览时已计算的帧
+    for (size_t t = 0; t < tracks.size(); ++t) {
+        auto& frames = tracks[t][0].frames;
+        if (!frames.empty()) continue;
+        frames.resize(numFrames);
+        for (auto& item : sparseFrames[t]) {
+            frames[item.first] = std::move(item.second);
+        }
+        sparseFrames[t].clear();
+    }
+    return computeFrames(1, error);
+}
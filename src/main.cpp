@@ -1,76 +1,26 @@
 #include <filesystem>
 #include <iostream>
+#include <fstream>
 #include <string>
-#include <sndfile.h>
 #include <vector>
-#include <cstring>
-#include <map>
-#include <cmath>
-#include <regex>
-#include <optional>
 #include <algorithm>
+#include <chrono>
+#include <iomanip>
 #include "version.hpp"
 #include "spectrogram.hpp"
-#include "note_utils.hpp"
+#include "pipeline.hpp"
+#include "options.hpp"
+#include "server.hpp"
+#include "analyzer.hpp"
+#include "fingerprint.hpp"
 
 namespace fs = std::filesystem;
 
-void processAudioFile(const std::string& inputFile, const std::string& outputFile, const Spectrogram::Config& config) {
-    std::cout << "处理文件: " << inputFile << std::endl;
-    
-    // 打开音频文件
-    SF_INFO sfInfo;
-    memset(&sfInfo, 0, sizeof(sfInfo));
-    SNDFILE* sndFile = sf_open(inputFile.c_str(), SFM_READ, &sfInfo);
-    
-    if (!sndFile) {
-        std::cerr << "无法打开音频文件: " << inputFile << std::endl;
-        std::cerr << "错误信息: " << sf_strerror(nullptr) << std::endl;
-        return;
-    }
-    
-    std::cout << "音频信息: " << std::endl;
-    std::cout << "  采样率: " << sfInfo.samplerate << " Hz" << std::endl;
-    std::cout << "  声道数: " << sfInfo.channels << std::endl;
-    std::cout << "  总帧数: " << sfInfo.frames << std::endl;
-    
-    // 读取音频数据
-    std::vector<double> audioData(sfInfo.frames * sfInfo.channels);
-    sf_read_double(sndFile, audioData.data(), audioData.size());
-    sf_close(sndFile);
-    
-    // 如果是立体声，转换为单声道
-    std::vector<double> monoData;
-    if (sfInfo.channels == 2) {
-        std::cout << "转换立体声到单声道..." << std::endl;
-        monoData.resize(sfInfo.frames);
-        for (sf_count_t i = 0; i < sfInfo.frames; ++i) {
-            monoData[i] = (audioData[i*2] + audioData[i*2+1]) / 2.0;
-        }
-    } else {
-        monoData = std::move(audioData);
-    }
-    
-    // 计算频谱图
-    const int fftSize = 2048;
-    const int hopSize = sfInfo.samplerate / config.samples_per_sec;
-    const int numFrames = (monoData.size() - fftSize) / hopSize + 1;
-    
-    std::cout << "生成频谱图..." << std::endl;
-    std::cout << "  FFT大小: " << fftSize << std::endl;
-    std::cout << "  跳跃大小: " << hopSize << std::endl;
-    std::cout << "  总帧数: " << numFrames << std::endl;
-    
-    // 创建频谱数据
-    std::vector<std::vector<double>> specData(numFrames, std::vector<double>(fftSize/2 + 1));
-    
-    // ... FFT计算代码 ...
-    
-    // 生成频谱图
-    Spectrogram spectrogram;
-    spectrogram.generateSpectrogram(specData, outputFile, sfInfo.samplerate, config);
-    
-    std::cout << "已生成频谱图: " << outputFile << std::endl;
+// 处理单个文件，成功生成图像时返回 true
+bool processAudioFile(const std::string& inputFile, const std::string& outputFile,
+                      const Spectrogram::Config& config, const Pipeline::Config& pipelineConfig) {
+    Pipeline pipeline(pipelineConfig, config);
+    return pipeline.run({{inputFile, outputFile}}) == 1;
 }
 
 void printUsage(const char* programName) {
@@ -83,6 +33,21 @@ void printUsage(const char* programName) {
               << "  -s <n>       每秒采样次数（默认：100）\n"
               << "  -l <音符>    最低音符（默认：20Hz，人耳可听最低频率）\n"
               << "  -u <音符>    最高音符（默认：20kHz，人耳可听最高频率）\n"
+              << "  -c <模式>    声道模式：mono（混缩，默认）、channels（逐声道）、ms（左/右/中/侧）\n"
+              << "  --size <宽x高>         图像尺寸（默认：3200x2400）\n"
+              << "  --preview <宽x高>      快速预览：只计算该宽度需要的帧，生成覆盖整个片段的缩略图\n"
+              << "  --max-memory <MB>      流式渲染整段录音，峰值内存不超过该预算\n"
+              << "  --multi-res <列表>     多分辨率分析的 FFT 大小，如 8192,2048,512\n"
+              << "  --index <目录>         指纹索引：跳过已处理的文件，重复的录音链接到已有的图像\n"
+              << "  --decode-threads <n>   解码线程数（默认：1）\n"
+              << "  --analyze-threads <n>  FFT 分析线程数（默认：1）\n"
+              << "  --render-threads <n>   渲染和编码线程数（默认：1）\n"
+              << "  --queue-depth <n>      阶段之间的队列容量（默认：2）\n"
+              << "\n服务模式:\n"
+              << "  " << programName << " --server <套接字> [--workers <n>]\n"
+              << "  " << programName << " --client <套接字> <输入文件> <输出目录> [--bytes] [选项]\n"
+              << "\n相似查询:\n"
+              << "  " << programName << " --find-similar <索引目录> <音频文件> [-n <n>]\n"
               << "\n音符格式示例：C4（中央C）、D#3、Gb5 等\n"
               << "\n注意：\n"
               << "1. 开始时间、结束时间、持续时间中只能指定其中两个\n"
@@ -91,7 +56,154 @@ void printUsage(const char* programName) {
               << std::endl;
 }
 
+// 常驻服务：msa --server <套接字> [--workers <n>]
+int runServer(int argc, char* argv[]) {
+    SpectrumServer::Config serverConfig;
+    serverConfig.socket_path = argv[2];
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--workers" && i + 1 < argc) {
+            try {
+                serverConfig.workers = std::stoi(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << "参数错误: " << e.what() << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "未知选项: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    SpectrumServer server(serverConfig);
+    std::string error;
+    if (!server.run(error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// 客户端：msa --client <套接字> <输入文件> <输出目录> [--bytes] [选项]
+// 指定 --bytes 时由服务返回 PNG 数据，客户端将其写入 <输出目录> 下的同名 PNG
+int runClient(int argc, char* argv[]) {
+    std::string socketPath = argv[2];
+    std::string inputFile = argv[3];
+    std::string outputDir = argv[4];
+
+    bool returnBytes = false;
+    std::vector<std::string> options;
+    for (int i = 5; i < argc; i++) {
+        if (std::string(argv[i]) == "--bytes") {
+            returnBytes = true;
+        } else {
+            options.push_back(argv[i]);
+        }
+    }
+
+    // 输入文件的相对路径由服务端解析，因此先转换为绝对路径
+    std::string result;
+    std::string error;
+    if (!sendServerRequest(socketPath, returnBytes,
+                           fs::absolute(inputFile).string(), fs::absolute(outputDir).string(),
+                           options, result, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    if (!returnBytes) {
+        std::cout << result << std::endl;
+        return 0;
+    }
+
+    std::string outputFile = outputFileFor(inputFile, outputDir);
+    std::error_code ec;
+    fs::create_directories(outputDir, ec);
+    std::ofstream out(outputFile, std::ios::binary);
+    if (!out.write(result.data(), result.size())) {
+        std::cerr << "写入文件失败: " << outputFile << std::endl;
+        return 1;
+    }
+    std::cout << outputFile << std::endl;
+    return 0;
+}
+
+// 相似查询：msa --find-similar <索引目录> <音频文件> [-n <n>]
+// 已索引的文件直接读取保存的指纹，其余文件解码一次后计算指纹
+int runFindSimilar(int argc, char* argv[]) {
+    std::string indexDir = argv[2];
+    std::string inputFile = argv[3];
+    size_t maxResults = 10;
+    for (int i = 4; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc) {
+            try {
+                maxResults = static_cast<size_t>(std::max(1, std::stoi(argv[++i])));
+            } catch (const std::exception& e) {
+                std::cerr << "参数错误: " << e.what() << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "未知选项: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    FingerprintIndex index;
+    std::string error;
+    if (!index.open(indexDir, error)) {
+        std::cerr << "无法打开指纹索引: " << error << std::endl;
+        return 1;
+    }
+
+    std::vector<FingerprintHash> hashes;
+    int64_t excludeId = -1;
+    const FingerprintIndex::Entry* entry = index.find(inputFile);
+    if (entry && index.unchanged(*entry) && index.loadFingerprint(*entry, hashes, error)) {
+        excludeId = entry->id;
+    } else {
+        std::cout << "文件不在索引中，正在解码: " << inputFile << std::endl;
+        Spectrogram::Config config;
+        AudioClip clip;
+        if (!decodeAudioFile(inputFile, config, ChannelMode::Mono, clip, error)) {
+            std::cerr << "无法打开音频文件: " << inputFile << "\n错误信息: " << error << std::endl;
+            return 1;
+        }
+        AnalyzerCache analyzers;
+        auto tracks = analyzers.analyze(clip, config, Pipeline::Config().fft_size, {});
+        hashes = computeFingerprint(tracks[0], clip.sampleRate);
+    }
+
+    auto matches = index.query(hashes, maxResults, excludeId);
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+
+    if (matches.empty()) {
+        std::cout << "没有找到相似的录音" << std::endl;
+    }
+    for (const auto& match : matches) {
+        std::cout << std::fixed << std::setprecision(3) << match.similarity
+                  << "  覆盖 " << match.coverage
+                  << "  偏移 " << std::setprecision(2) << match.offset << " 秒  "
+                  << match.entry->input_file << "  ->  " << match.entry->output_file << std::endl;
+    }
+    std::cout << "已索引 " << index.size() << " 个文件，查询用时 "
+              << std::fixed << std::setprecision(1) << elapsed << " ms" << std::endl;
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
+    // 服务和客户端模式不输出调试信息，以降低每次请求的开销
+    if (argc >= 3 && std::string(argv[1]) == "--server") {
+        return runServer(argc, argv);
+    }
+    if (argc >= 5 && std::string(argv[1]) == "--client") {
+        return runClient(argc, argv);
+    }
+    if (argc >= 4 && std::string(argv[1]) == "--find-similar") {
+        return runFindSimilar(argc, argv);
+    }
+
     std::cout << "Debug: Program started with " << argc << " arguments" << std::endl;
     for (int i = 0; i < argc; ++i) {
         std::cout << "Debug: argv[" << i << "] = " << argv[i] << std::endl;
@@ -122,6 +234,21 @@ int main(int argc, char* argv[]) {
         std::cout << "  -s <n>                        每秒采样次数（默认：100）" << std::endl;
         std::cout << "  -l <音符>                     最低音符（默认：20Hz）" << std::endl;
         std::cout << "  -u <音符>                     最高音符（默认：20kHz）" << std::endl;
+        std::cout << "  -c <模式>                     声道模式：mono（默认）、channels、ms" << std::endl;
+        std::cout << "  --size <宽x高>                图像尺寸（默认：3200x2400）" << std::endl;
+        std::cout << "  --preview <宽x高>             快速预览，生成覆盖整个片段的缩略图" << std::endl;
+        std::cout << "  --max-memory <MB>             流式渲染整段录音，峰值内存不超过该预算" << std::endl;
+        std::cout << "  --multi-res <列表>            多分辨率分析的 FFT 大小，如 8192,2048,512" << std::endl;
+        std::cout << "  --index <目录>                指纹索引：跳过已处理的文件，链接重复的录音" << std::endl;
+        std::cout << "  --decode-threads <n>          解码线程数（默认：1）" << std::endl;
+        std::cout << "  --analyze-threads <n>         FFT 分析线程数（默认：1）" << std::endl;
+        std::cout << "  --render-threads <n>          渲染和编码线程数（默认：1）" << std::endl;
+        std::cout << "  --queue-depth <n>             阶段之间的队列容量（默认：2）" << std::endl;
+        std::cout << "\n服务模式:" << std::endl;
+        std::cout << "  " << programName << " --server <套接字> [--workers <n>]" << std::endl;
+        std::cout << "  " << programName << " --client <套接字> <输入文件> <输出目录> [--bytes] [选项]" << std::endl;
+        std::cout << "\n相似查询:" << std::endl;
+        std::cout << "  " << programName << " --find-similar <索引目录> <音频文件> [-n <n>]" << std::endl;
         std::cout << "\n音符格式示例：C4（中央C）、D#3、Gb5 等\n";
         std::cout << "\n支持的音频格式：WAV, FLAC, OGG 等\n";
         std::cout << "\n注意：开始时间、结束时间、持续时间中只能指定其中两个\n";
@@ -136,91 +263,19 @@ int main(int argc, char* argv[]) {
     std::cout << "输入路径: " << inputPath << std::endl;
     std::cout << "输出路径: " << outputPath << std::endl;
 
-    // 配置选项
-    Spectrogram::Config config;
-    std::optional<double> endTime;
-    bool hasStartTime = false;
-    bool hasDuration = false;
-    bool hasEndTime = false;
-    
     // 解析命令行选项
-    for (int i = 3; i < argc; i++) {
-        std::string arg = argv[i];
-        if (i + 1 >= argc) {
-            std::cerr << "错误：选项 " << arg << " 需要一个参数" << std::endl;
-            return 1;
-        }
-        
-        try {
-            if (arg == "-s") {
-                config.samples_per_sec = std::stoi(argv[++i]);
-                std::cout << "设置每秒采样数为: " << config.samples_per_sec << std::endl;
-            }
-            else if (arg == "-l") {
-                try {
-                    config.min_freq = noteToFreq(argv[++i]);
-                    std::cout << "设置最低频率为: " << config.min_freq << " Hz" << std::endl;
-                } catch (const std::exception& e) {
-                    config.min_freq = std::stod(argv[i]);
-                    std::cout << "设置最低频率为: " << config.min_freq << " Hz" << std::endl;
-                }
-            }
-            else if (arg == "-u") {
-                try {
-                    config.max_freq = noteToFreq(argv[++i]);
-                    std::cout << "设置最高频率为: " << config.max_freq << " Hz" << std::endl;
-                } catch (const std::exception& e) {
-                    config.max_freq = std::stod(argv[i]);
-                    std::cout << "设置最高频率为: " << config.max_freq << " Hz" << std::endl;
-                }
-            }
-            else if (arg == "-b") {
-                config.start_time = std::stod(argv[++i]);
-                hasStartTime = true;
-                std::cout << "设置开始时间为: " << config.start_time << " 秒" << std::endl;
-            }
-            else if (arg == "-e") {
-                endTime = std::stod(argv[++i]);
-                hasEndTime = true;
-                std::cout << "设置结束时间为: " << endTime.value() << " 秒" << std::endl;
-            }
-            else if (arg == "-d") {
-                config.duration = std::stod(argv[++i]);
-                hasDuration = true;
-                std::cout << "设置持续时间为: " << config.duration << " 秒" << std::endl;
-            }
-            else if (arg == "-h") {
-                // 帮助信息已经在前面处理过了
-                return 0;
-            }
-            else {
-                std::cerr << "未知选项: " << arg << std::endl;
-                return 1;
-            }
-        } catch (const std::exception& e) {
-            std::cerr << "参数错误: " << e.what() << std::endl;
-            return 1;
-        }
-    }
-
-    // 检查时间参数的组合
-    int timeParamsCount = hasStartTime + hasDuration + hasEndTime;
-    if (timeParamsCount > 2) {
-        std::cerr << "错误：开始时间、结束时间、持续时间只能指定其中两个\n";
+    Options options;
+    std::string error;
+    if (!parseOptions(std::vector<std::string>(argv + 3, argv + argc), options, error, &std::cout)) {
+        std::cerr << error << std::endl;
         return 1;
     }
-
-    // 根据指定的时间参数计算持续时间
-    if (hasEndTime) {
-        if (endTime.value() <= config.start_time) {
-            std::cerr << "错误：结束时间必须大于开始时间\n";
-            return 1;
-        }
-        if (!hasDuration) {
-            config.duration = endTime.value() - config.start_time;
-            std::cout << "计算得到持续时间为: " << config.duration << " 秒" << std::endl;
-        }
+    if (options.help) {
+        // 帮助信息已经在前面处理过了
+        return 0;
     }
+    const Spectrogram::Config& config = options.spec;
+    const Pipeline::Config& pipelineConfig = options.pipeline;
 
     // 创建输出目录
     try {
@@ -234,18 +289,24 @@ int main(int argc, char* argv[]) {
     // 处理输入
     if (fs::is_directory(inputPath)) {
         std::cout << "处理目录: " << inputPath << std::endl;
+        std::vector<Pipeline::Job> jobs;
         for (const auto& entry : fs::directory_iterator(inputPath)) {
             if (entry.path().extension() == ".wav" || entry.path().extension() == ".mp3") {
-                std::string outputFile = (fs::path(outputPath) / entry.path().filename()).string();
-                outputFile = outputFile.substr(0, outputFile.find_last_of('.')) + ".png";
-                processAudioFile(entry.path().string(), outputFile, config);
+                jobs.push_back({entry.path().string(), outputFileFor(entry.path().string(), outputPath)});
             }
         }
+        Pipeline pipeline(pipelineConfig, config);
+        size_t done = pipeline.run(jobs);
+        std::cout << "完成: " << done << "/" << jobs.size() << " 个文件" << std::endl;
+        if (done < jobs.size()) {
+            std::cerr << "失败: " << jobs.size() - done << " 个文件" << std::endl;
+            return 1;
+        }
     } else {
         std::cout << "处理单个文件: " << inputPath << std::endl;
-        std::string outputFile = (fs::path(outputPath) / fs::path(inputPath).filename()).string();
-        outputFile = outputFile.substr(0, outputFile.find_last_of('.')) + ".png";
-        processAudioFile(inputPath, outputFile, config);
+        if (!processAudioFile(inputPath, outputFileFor(inputPath, outputPath), config, pipelineConfig)) {
+            return 1;
+        }
     }
 
     return 0;
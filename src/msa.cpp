@@ -0,0 +1,199 @@
+#include "msa.h"
+#include "audio_processor.hpp"
+#include <algorithm>
+#include <exception>
+#include <new>
+
+struct msa_processor {
+    AudioProcessor processor;
+    mutable std::string error;   // 查询结果的函数也可能失败，因此允许在 const 处理器上记录
+};
+
+namespace {
+
+const Spectrogram::Band* findBand(const msa_processor* processor, int track, int band) {
+    if (!processor) return nullptr;
+    const auto& tracks = processor->processor.getTracks();
+    if (track < 0 || track >= static_cast<int>(tracks.size())) return nullptr;
+    if (band < 0 || band >= static_cast<int>(tracks[track].size())) return nullptr;
+    return &tracks[track][band];
+}
+
+// 每次调用先清除上次的错误；异常不能穿过 C 接口：捕获后记录原因并返回 fallback
+template <typename Result, typename Body>
+Result guard(const msa_processor* processor, Result fallback, Body body) {
+    const char* reason = "未知错误";
+    if (processor) processor->error.clear();
+    try {
+        return body();
+    } catch (const std::bad_alloc&) {
+        reason = "内存不足";
+    } catch (const std::exception& e) {
+        reason = e.what();
+    } catch (...) {
+    }
+    if (processor) {
+        try {
+            processor->error = reason;
+        } catch (...) {
+            processor->error.clear();
+        }
+    }
+    return fallback;
+}
+
+} // namespace
+
+void msa_default_options(msa_options* options) {
+    if (!options) return;
+    AudioProcessor::Options defaults;
+    options->start_time = defaults.spec.start_time;
+    options->duration = defaults.spec.duration;
+    options->samples_per_sec = defaults.spec.samples_per_sec;
+    options->min_freq = defaults.spec.min_freq;
+    options->max_freq = defaults.spec.max_freq;
+    options->fft_size = defaults.fft_size;
+    options->resolution_ffts = nullptr;
+    options->num_resolution_ffts = 0;
+    options->channel_mode = MSA_CHANNELS_MONO;
+    options->threads = defaults.threads;
+}
+
+msa_processor* msa_create(const msa_options* options) {
+    msa_options defaults;
+    msa_default_options(&defaults);
+    if (!options) options = &defaults;
+
+    if (options->samples_per_sec <= 0 || options->fft_size < 16 ||
+        options->min_freq <= 0 || options->max_freq <= options->min_freq ||
+        options->channel_mode < MSA_CHANNELS_MONO || options->channel_mode > MSA_CHANNELS_MID_SIDE) {
+        return nullptr;
+    }
+    // 与命令行的 --multi-res 相同，每个 FFT 大小不小于 16
+    if (options->num_resolution_ffts < 0 || (options->num_resolution_ffts > 0 && !options->resolution_ffts)) {
+        return nullptr;
+    }
+    for (int i = 0; i < options->num_resolution_ffts; ++i) {
+        if (options->resolution_ffts[i] < 16) return nullptr;
+    }
+
+    return guard<msa_processor*>(nullptr, nullptr, [&] {
+        AudioProcessor::Options processorOptions;
+        processorOptions.spec.start_time = options->start_time;
+        processorOptions.spec.duration = options->duration;
+        processorOptions.spec.samples_per_sec = options->samples_per_sec;
+        processorOptions.spec.min_freq = options->min_freq;
+        processorOptions.spec.max_freq = options->max_freq;
+        processorOptions.fft_size = options->fft_size;
+        if (options->num_resolution_ffts > 0) {
+            processorOptions.resolution_ffts.assign(options->resolution_ffts,
+                                                    options->resolution_ffts + options->num_resolution_ffts);
+        }
+        processorOptions.channel_mode = static_cast<ChannelMode>(options->channel_mode);
+        processorOptions.threads = std::max(1, options->threads);
+
+        msa_processor* processor = new msa_processor;
+        processor->processor.setOptions(processorOptions);
+        return processor;
+    });
+}
+
+void msa_destroy(msa_processor* processor) {
+    delete processor;
+}
+
+const char* msa_last_error(const msa_processor* processor) {
+    return processor ? processor->error.c_str() : "无效的处理器";
+}
+
+int msa_analyze_file(msa_processor* processor, const char* path) {
+    if (!processor) return 0;
+    return guard(processor, 0, [&] {
+        if (!path) {
+            processor->error = "文件路径为空";
+            return 0;
+        }
+        return processor->processor.analyzeFile(path, processor->error) ? 1 : 0;
+    });
+}
+
+int msa_analyze_pcm_f64(msa_processor* processor, const double* samples, size_t frames,
+                        int channels, int sample_rate) {
+    if (!processor) return 0;
+    return guard(processor, 0, [&] {
+        return processor->processor.analyzeSamples(samples, frames, channels, sample_rate,
+                                                   processor->error) ? 1 : 0;
+    });
+}
+
+int msa_analyze_pcm_f32(msa_processor* processor, const float* samples, size_t frames,
+                        int channels, int sample_rate) {
+    if (!processor) return 0;
+    return guard(processor, 0, [&] {
+        return processor->processor.analyzeSamples(samples, frames, channels, sample_rate,
+                                                   processor->error) ? 1 : 0;
+    });
+}
+
+int msa_track_count(const msa_processor* processor) {
+    if (!processor) return 0;
+    return guard(processor, 0, [&] {
+        return static_cast<int>(processor->processor.getTracks().size());
+    });
+}
+
+int msa_band_count(const msa_processor* processor, int track) {
+    if (!processor) return 0;
+    return guard(processor, 0, [&] {
+        const auto& tracks = processor->processor.getTracks();
+        if (track < 0 || track >= static_cast<int>(tracks.size())) return 0;
+        return static_cast<int>(tracks[track].size());
+    });
+}
+
+int msa_band_info_get(const msa_processor* processor, int track, int band, msa_band_info* info) {
+    return guard(processor, 0, [&] {
+        const Spectrogram::Band* source = findBand(processor, track, band);
+        if (!source || !info) {
+            if (processor) processor->error = source ? "info 为空" : "无效的声道或频段";
+            return 0;
+        }
+        info->fft_size = source->fft_size;
+        info->hop_size = source->hop_size;
+        info->first_bin = source->first_bin;
+        info->min_freq = source->min_freq;
+        info->max_freq = source->max_freq;
+        info->num_frames = source->frames.size();
+        info->num_bins = source->frames.empty() ? 0 : source->frames[0].size();
+        info->freqs = source->freqs.empty() ? nullptr : source->freqs.data();
+        return 1;
+    });
+}
+
+size_t msa_copy_band(const msa_processor* processor, int track, int band, double* out, size_t capacity) {
+    return guard<size_t>(processor, 0, [&]() -> size_t {
+        const Spectrogram::Band* source = findBand(processor, track, band);
+        if (!source) {
+            if (processor) processor->error = "无效的声道或频段";
+            return 0;
+        }
+        if (source->frames.empty()) return 0;
+
+        const size_t numBins = source->frames[0].size();
+        const size_t needed = source->frames.size() * numBins;
+        if (!out || capacity < needed) return needed;
+
+        double* cursor = out;
+        for (const auto& frame : source->frames) {
+            cursor = std::copy(frame.begin(), frame.end(), cursor);
+        }
+        return needed;
+    });
+}
+
+int msa_render_rgb(msa_processor* processor, unsigned char* pixels, int width, int height, size_t stride) {
+    if (!processor) return 0;
+    return guard(processor, 0, [&] {
+        return processor->processor.render(pixels, width, height, stride, processor->error) ? 1 : 0;
+    });
+}
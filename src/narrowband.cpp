@@ -0,0 +1,230 @@
+#include "narrowband.hpp"
+#include "analyzer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+namespace {
+
+constexpr double kMaxFullBandBins = 32.0;   // 全频带 FFT 在范围内的 bin 少于该值时使用窄带分析
+constexpr double kBinsInBand = 16.0;        // 窗长使整个频带跨越的分辨率单元数
+constexpr double kMaxWindowSeconds = 0.08;  // 窗长上限，保留足够的时间分辨率（如 6 Hz 的颤音）
+constexpr int kZoomPadding = 8;             // 缩放 FFT 的补零倍数，插值误差可以忽略
+
+} // namespace
+
+NarrowBandAnalyzer::~NarrowBandAnalyzer() {
+    if (plan) {
+        std::lock_guard<std::mutex> lock(fftwPlannerMutex());
+        fftw_destroy_plan(plan);
+    }
+    fftw_free(in);
+    fftw_free(out);
+}
+
+bool NarrowBandAnalyzer::applies(const Spectrogram::Config& config, int sampleRate, int fftSize) {
+    if (config.min_freq <= 0 || config.max_freq <= config.min_freq || config.height <= 0) return false;
+    if (config.max_freq > sampleRate / 2.0) return false;
+    return (config.max_freq - config.min_freq) * fftSize / sampleRate < kMaxFullBandBins;
+}
+
+void NarrowBandAnalyzer::preparePlan(int size) {
+    if (size == planSize) return;
+
+    std::lock_guard<std::mutex> lock(fftwPlannerMutex());
+    if (plan) fftw_destroy_plan(plan);
+    fftw_free(in);
+    fftw_free(out);
+    in = fftw_alloc_complex(size);
+    out = fftw_alloc_complex(size);
+    plan = fftw_plan_dft_1d(size, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
+    planSize = size;
+}
+
+Spectrogram::Band NarrowBandAnalyzer::compute(const double* samples, size_t count, int sampleRate,
+                                              int hopSize, const Spectrogram::Config& config, int fftSize) {
+    const double center = (config.min_freq + config.max_freq) / 2;
+    const double halfWidth = (config.max_freq - config.min_freq) / 2;
+    const int rows = config.height;
+
+    // 抽取后基带采样率至少为带宽的两倍，留出同样宽的过渡带
+    const int decimation = std::max(1, static_cast<int>(sampleRate / (4 * halfWidth)));
+    const double basebandRate = static_cast<double>(sampleRate) / decimation;
+
+    // 复解调和低通合并为一个复系数的带通滤波器：y[m] = e^{-jω0 mD} Σ x[mD+t] h[t] e^{-jω0 t}
+    // h 为 Blackman 窗的 sinc 低通，截止于 2B（sin(πct)/(πct) 的截止频率为 c/2 个周期每采样），
+    // 过渡带为 B 到 3B：B 以内无衰减，3B 以外衰减约 74 dB，正好是抽取后混叠到 ±B 的频率
+    const double omega0 = 2 * M_PI * center / sampleRate;
+    const int taps = static_cast<int>(std::ceil(1.375 * sampleRate / halfWidth));
+    const double cutoff = 4 * halfWidth / sampleRate;
+    std::vector<double> filterRe(2 * taps + 1), filterIm(2 * taps + 1);
+    double gain = 0.0;
+    for (int t = -taps; t <= taps; ++t) {
+        double x = M_PI * t / (taps + 1);
+        double blackman = 0.42 + 0.5 * std::cos(x) + 0.08 * std::cos(2 * x);
+        double sinc = t == 0 ? 1.0 : std::sin(M_PI * cutoff * t) / (M_PI * cutoff * t);
+        double h = blackman * sinc;
+        filterRe[t + taps] = h * std::cos(omega0 * t);
+        filterIm[t + taps] = -h * std::sin(omega0 * t);
+        gain += h;
+    }
+    for (int i = 0; i <= 2 * taps; ++i) {
+        filterRe[i] /= gain;
+        filterIm[i] /= gain;
+    }
+
+    const size_t numBaseband = std::max<size_t>(1, (count + decimation - 1) / decimation);
+    baseband.resize(numBaseband);
+    for (size_t m = 0; m < numBaseband; ++m) {
+        const long position = static_cast<long>(m) * decimation;
+        const long first = std::max<long>(-taps, -position);
+        const long last = std::min<long>(taps, static_cast<long>(count) - 1 - position);
+        double re = 0.0, im = 0.0;
+        for (long t = first; t <= last; ++t) {
+            re += samples[position + t] * filterRe[t + taps];
+            im += samples[position + t] * filterIm[t + taps];
+        }
+        baseband[m] = std::complex<double>(re, im) *
+                      std::polar(1.0, -std::fmod(omega0 * static_cast<double>(position), 2 * M_PI));
+    }
+
+    // 窗长使整个频带跨越 kBinsInBand 个分辨率单元，但不短于全频带分析的窗
+    const int windowLength = std::max(fftSize, static_cast<int>(std::min(
+        kBinsInBand * sampleRate / (2 * halfWidth), kMaxWindowSeconds * sampleRate)));
+    const int basebandLength = std::max(2, static_cast<int>(std::lround(
+        static_cast<double>(windowLength) / decimation)));
+    window.resize(basebandLength);
+    double windowSum = 0.0;
+    for (int n = 0; n < basebandLength; ++n) {
+        window[n] = 0.5 * (1 - std::cos(2 * M_PI * n / (basebandLength - 1)));
+        windowSum += window[n];
+    }
+    // 振幅为 1 的实正弦解调后振幅为 1/2
+    reference = windowSum / 2;
+
+    // 与 Spectrogram::mapRows 中同样高度图像的行中心相同的频率
+    Spectrogram::Band band;
+    band.fft_size = windowLength;
+    band.hop_size = hopSize;
+    band.min_freq = config.min_freq;
+    band.max_freq = std::nextafter(config.max_freq, 2 * config.max_freq);
+    band.freqs.resize(rows);
+    omegas.resize(rows);
+    const double logMin = std::log2(config.min_freq);
+    const double logMax = std::log2(config.max_freq);
+    for (int k = 0; k < rows; ++k) {
+        band.freqs[k] = std::exp2(logMin + (logMax - logMin) * (k + 0.5) / rows);
+        omegas[k] = 2 * M_PI * (band.freqs[k] - center) / basebandRate;
+    }
+
+    // 按每帧的运算量选择求值方式
+    int zoomSize = 16;
+    while (zoomSize < kZoomPadding * basebandLength) zoomSize *= 2;
+    const double goertzelCost = 4.0 * basebandLength * rows;
+    const double zoomCost = 5.0 * zoomSize * std::log2(zoomSize) + 4.0 * (zoomSize + rows);
+    method = goertzelCost <= zoomCost ? Method::Goertzel : Method::ZoomFft;
+
+    if (method == Method::Goertzel) {
+        coefficients.resize(rows);
+        for (int k = 0; k < rows; ++k) {
+            coefficients[k] = 2 * std::cos(omegas[k]);
+        }
+    } else {
+        preparePlan(zoomSize);
+        magnitudes.resize(zoomSize);
+        // 各行频率最近的 bin 及相对它的偏移，负频率在后半部分
+        rowBins.resize(rows);
+        rowOffsets.resize(rows);
+        for (int k = 0; k < rows; ++k) {
+            double position = omegas[k] / (2 * M_PI) * zoomSize;
+            double nearest = std::round(position);
+            rowBins[k] = (static_cast<int>(nearest) % zoomSize + zoomSize) % zoomSize;
+            rowOffsets[k] = position - nearest;
+        }
+    }
+
+    const size_t numFrames = std::max<size_t>(1, (count + hopSize - 1) / hopSize);
+    band.frames.assign(numFrames, std::vector<double>(rows));
+    for (size_t frame = 0; frame < numFrames; ++frame) {
+        const double centerSample = static_cast<double>(frame) * hopSize / decimation;
+        const long start = std::lround(centerSample - (basebandLength - 1) / 2.0);
+        if (method == Method::Goertzel) {
+            goertzel(start, band.frames[frame]);
+        } else {
+            zoomFft(start, band.frames[frame]);
+        }
+    }
+    return band;
+}
+
+double NarrowBandAnalyzer::intensity(double magnitude) const {
+    double db = 20 * std::log10(magnitude / reference + 1e-12);
+    return std::clamp((db + StftAnalyzer::kDynamicRangeDb) / StftAnalyzer::kDynamicRangeDb, 0.0, 1.0);
+}
+
+void NarrowBandAnalyzer::goertzel(long start, std::vector<double>& column) {
+    const size_t rows = coefficients.size();
+    stateRe1.assign(rows, 0.0);
+    stateRe2.assign(rows, 0.0);
+    stateIm1.assign(rows, 0.0);
+    stateIm2.assign(rows, 0.0);
+    double* re1 = stateRe1.data();
+    double* re2 = stateRe2.data();
+    double* im1 = stateIm1.data();
+    double* im2 = stateIm2.data();
+    const double* coefficient = coefficients.data();
+
+    // 每个采样对所有频率做一步递推，内层循环没有依赖，可以向量化
+    const long length = static_cast<long>(window.size());
+    for (long n = 0; n < length; ++n) {
+        const long index = start + n;
+        std::complex<double> sample = index >= 0 && index < static_cast<long>(baseband.size())
+            ? baseband[index] * window[n]
+            : std::complex<double>();
+        const double xr = sample.real();
+        const double xi = sample.imag();
+        for (size_t k = 0; k < rows; ++k) {
+            double r = xr + coefficient[k] * re1[k] - re2[k];
+            double i = xi + coefficient[k] * im1[k] - im2[k];
+            re2[k] = re1[k];
+            re1[k] = r;
+            im2[k] = im1[k];
+            im1[k] = i;
+        }
+    }
+
+    // X(ω) 与 s[N-1] - e^{-jω} s[N-2] 只差一个相位因子
+    for (size_t k = 0; k < rows; ++k) {
+        const double c = std::cos(omegas[k]);
+        const double s = std::sin(omegas[k]);
+        const double re = re1[k] - c * re2[k] - s * im2[k];
+        const double im = im1[k] - c * im2[k] + s * re2[k];
+        column[k] = intensity(std::sqrt(re * re + im * im));
+    }
+}
+
+void NarrowBandAnalyzer::zoomFft(long start, std::vector<double>& column) {
+    const long length = static_cast<long>(window.size());
+    for (long n = 0; n < planSize; ++n) {
+        const long index = start + n;
+        std::complex<double> sample = n < length && index >= 0 && index < static_cast<long>(baseband.size())
+            ? baseband[index] * window[n]
+            : std::complex<double>();
+        in[n][0] = sample.real();
+        in[n][1] = sample.imag();
+    }
+    fftw_execute(plan);
+    for (int m = 0; m < planSize; ++m) {
+        magnitudes[m] = intensity(std::sqrt(out[m][0] * out[m][0] + out[m][1] * out[m][1]));
+    }
+
+    // 用最近的三个 bin 的强度（对数刻度）做二次插值，峰值位置不会被吸附到 bin 上
+    for (size_t k = 0; k < column.size(); ++k) {
+        const double center = magnitudes[rowBins[k]];
+        const double below = magnitudes[(rowBins[k] + planSize - 1) % planSize];
+        const double above = magnitudes[(rowBins[k] + 1) % planSize];
+        const double d = rowOffsets[k];
+        const double value = center + d * (above - below) / 2 + d * d * (above - 2 * center + below) / 2;
+        column[k] = std::clamp(value, 0.0, 1.0);
+    }
+}
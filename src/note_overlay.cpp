@@ -0,0 +1,234 @@
+#include "note_overlay.hpp"
+#include "note_utils.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+namespace {
+
+constexpr int kGlyphWidth = 5;
+constexpr int kGlyphHeight = 7;
+constexpr int kLabelX = 5;                  // 标签左边距，与 Core Graphics 路径相同
+constexpr size_t kMaxCachedOverlays = 8;
+
+// 5x7 点阵字体，每个字形 7 行，每行低 5 位自左向右
+struct Glyph {
+    char ch;
+    uint8_t rows[kGlyphHeight];
+};
+
+constexpr Glyph kGlyphs[] = {
+    {'0', {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}},
+    {'1', {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E}},
+    {'2', {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}},
+    {'3', {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}},
+    {'4', {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}},
+    {'5', {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}},
+    {'6', {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}},
+    {'7', {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}},
+    {'8', {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}},
+    {'9', {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}},
+    {'A', {0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}},
+    {'B', {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}},
+    {'C', {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}},
+    {'D', {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C}},
+    {'E', {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}},
+    {'F', {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10}},
+    {'G', {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}},
+    {'#', {0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A}},
+};
+
+const Glyph* findGlyph(char ch) {
+    for (const Glyph& glyph : kGlyphs) {
+        if (glyph.ch == ch) return &glyph;
+    }
+    return nullptr;
+}
+
+// 光栅化过程中的一行：标签的像素按列存放，其余部分为整行的刻度线（若有）
+struct RowLayer {
+    bool line = false;
+    std::map<int, std::array<unsigned char, 4>> labels;
+};
+
+// dst * (255 - a) + c * a 不超过 255 * 255，除以 255 时四舍五入
+inline unsigned char blendByte(unsigned char dst, uint8_t inverse, uint16_t premultiplied) {
+    uint16_t value = static_cast<uint16_t>(dst * inverse + premultiplied + 128);
+    return static_cast<unsigned char>((value + (value >> 8)) >> 8);
+}
+
+using CacheKey = std::tuple<int, int, int, double, double, std::array<unsigned char, 8>>;
+
+} // namespace
+
+std::shared_ptr<const NoteOverlay> NoteOverlay::get(int width, int height, int panels,
+                                                    double minFreq, double maxFreq,
+                                                    const OverlayPalette& palette) {
+    static std::mutex mutex;
+    static std::deque<std::pair<CacheKey, std::shared_ptr<const NoteOverlay>>> cache;
+
+    const CacheKey key{width, height, panels, minFreq, maxFreq,
+                       {palette.line[0], palette.line[1], palette.line[2], palette.line_alpha,
+                        palette.text[0], palette.text[1], palette.text[2], palette.text_alpha}};
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->first == key) {
+            // 最近使用的放在末尾
+            auto entry = *it;
+            cache.erase(it);
+            cache.push_back(entry);
+            return entry.second;
+        }
+    }
+
+    std::shared_ptr<const NoteOverlay> overlay(
+        new NoteOverlay(width, height, panels, minFreq, maxFreq, palette));
+    cache.emplace_back(key, overlay);
+    if (cache.size() > kMaxCachedOverlays) cache.pop_front();
+    return overlay;
+}
+
+NoteOverlay::NoteOverlay(int width, int height, int panels, double minFreq, double maxFreq,
+                         const OverlayPalette& palette) {
+    if (width <= 0 || height <= 0 || minFreq <= 0 || maxFreq <= minFreq) return;
+
+    std::map<int, RowLayer> layers;
+    auto plot = [&](int x, int y, const unsigned char* color, unsigned char alpha) {
+        if (x < 0 || x >= width || y < 0 || y >= height) return;
+        layers[y].labels[x] = {color[0], color[1], color[2], alpha};
+    };
+
+    panels = std::max(1, panels);
+    const double logMin = std::log2(minFreq);
+    const double logMax = std::log2(maxFreq);
+    for (int panel = 0; panel < panels; ++panel) {
+        const int top = height * panel / panels;
+        const int bottom = height * (panel + 1) / panels;
+        const int panelHeight = bottom - top;
+        // 较高的图像用两倍大小的字形，接近 Core Graphics 路径的 12 号字
+        const int scale = panelHeight >= 600 ? 2 : 1;
+        const int glyphHeight = kGlyphHeight * scale;
+
+        // 与 Spectrogram::freqToY 相同的对数刻度，第 0 行为最高频率
+        std::vector<std::pair<int, std::string>> lines;
+        for (int octave = 1; octave <= 8; ++octave) {
+            for (const char* note : {"C", "D", "E", "F", "G", "A", "B"}) {
+                std::string name = std::string(note) + std::to_string(octave);
+                double freq = noteToFreq(name);
+                if (freq < minFreq || freq > maxFreq) continue;
+                int level = static_cast<int>(panelHeight * (std::log2(freq) - logMin) / (logMax - logMin));
+                int y = top + std::clamp(panelHeight - 1 - level, 0, panelHeight - 1);
+                lines.emplace_back(y, name);
+            }
+        }
+
+        for (const auto& line : lines) {
+            layers[line.first].line = true;
+        }
+
+        // 标签以刻度线为垂直中心，与上一个标签重叠时省略
+        int lastLabelTop = bottom;
+        for (const auto& line : lines) {
+            int labelTop = line.first - glyphHeight / 2;
+            if (labelTop < top || labelTop + glyphHeight > bottom || labelTop + glyphHeight >= lastLabelTop) continue;
+            lastLabelTop = labelTop;
+
+            int x = kLabelX;
+            for (char ch : line.second) {
+                const Glyph* glyph = findGlyph(ch);
+                if (glyph) {
+                    for (int gy = 0; gy < glyphHeight; ++gy) {
+                        const uint8_t bits = glyph->rows[gy / scale];
+                        for (int gx = 0; gx < kGlyphWidth * scale; ++gx) {
+                            if (bits & (0x10 >> (gx / scale))) {
+                                plot(x + gx, labelTop + gy, palette.text, palette.text_alpha);
+                            }
+                        }
+                    }
+                }
+                x += (kGlyphWidth + 1) * scale;
+            }
+        }
+    }
+
+    // 每行只保留有内容的范围，按字节展开以便混合时逐字节处理；
+    // 刻度线在最后一个标签像素之后的部分只存一个像素
+    const std::array<unsigned char, 4> linePixel = {palette.line[0], palette.line[1], palette.line[2],
+                                                    palette.line_alpha};
+    const std::array<unsigned char, 4> clear = {0, 0, 0, 0};
+    spans.reserve(layers.size());
+    for (const auto& item : layers) {
+        const RowLayer& row = item.second;
+        Span span;
+        span.y = item.first;
+        int first = row.line ? 0 : row.labels.begin()->first;
+        int last = row.labels.empty() ? -1 : row.labels.rbegin()->first;
+        if (row.line && last + 1 < width) {
+            span.repeat = static_cast<size_t>(width - last - 2);
+            ++last;
+        }
+        span.x = first;
+        const size_t count = static_cast<size_t>(last - first + 1) * 3;
+        span.inverse.resize(count);
+        span.premultiplied.resize(count);
+        for (int x = first; x <= last; ++x) {
+            auto label = row.labels.find(x);
+            const auto& pixel = label != row.labels.end() ? label->second : row.line ? linePixel : clear;
+            for (int c = 0; c < 3; ++c) {
+                const size_t i = static_cast<size_t>(x - first) * 3 + c;
+                span.inverse[i] = static_cast<uint8_t>(255 - pixel[3]);
+                span.premultiplied[i] = static_cast<uint16_t>(pixel[c] * pixel[3]);
+            }
+        }
+        spans.push_back(std::move(span));
+    }
+}
+
+void NoteOverlay::blendSpan(const Span& span, size_t from, size_t count, unsigned char* out) {
+    const size_t stored = span.inverse.size() / 3;
+    if (from < stored) {
+        const size_t n = std::min(count, stored - from) * 3;
+        const uint8_t* inverse = span.inverse.data() + from * 3;
+        const uint16_t* premultiplied = span.premultiplied.data() + from * 3;
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = blendByte(out[i], inverse[i], premultiplied[i]);
+        }
+        out += n;
+        from += n / 3;
+        count -= n / 3;
+    }
+
+    // 与最后一个像素相同的部分
+    const size_t n = std::min(count, stored + span.repeat - std::min(from, stored + span.repeat));
+    if (n == 0) return;
+    const uint8_t* inverse = span.inverse.data() + (stored - 1) * 3;
+    const uint16_t* premultiplied = span.premultiplied.data() + (stored - 1) * 3;
+    for (size_t p = 0; p < n; ++p) {
+        for (int c = 0; c < 3; ++c) {
+            out[p * 3 + c] = blendByte(out[p * 3 + c], inverse[c], premultiplied[c]);
+        }
+    }
+}
+
+void NoteOverlay::blend(unsigned char* pixels, size_t stride) const {
+    for (const Span& span : spans) {
+        unsigned char* out = pixels + span.y * stride + static_cast<size_t>(span.x) * 3;
+        blendSpan(span, 0, span.inverse.size() / 3 + span.repeat, out);
+    }
+}
+
+void NoteOverlay::blendRow(int y, size_t x, unsigned char* rgb, size_t count) const {
+    auto span = std::lower_bound(spans.begin(), spans.end(), y,
+                                 [](const Span& item, int row) { return item.y < row; });
+    if (span == spans.end() || span->y != y) return;
+
+    const size_t begin = std::max(x, static_cast<size_t>(span->x));
+    const size_t end = std::min(x + count, span->x + span->inverse.size() / 3 + span->repeat);
+    if (begin >= end) return;
+    blendSpan(*span, begin - span->x, end - begin, rgb + (begin - x) * 3);
+}
@@ -0,0 +1,206 @@
+#include "options.hpp"
+#include "note_utils.hpp"
+#include <filesystem>
+#include <sstream>
+#include <optional>
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// 音符或直接的频率数值
+double parseFrequency(const std::string& value) {
+    try {
+        return noteToFreq(value);
+    } catch (const std::exception&) {
+        return std::stod(value);
+    }
+}
+
+// 形如 640x480 的图像尺寸
+bool parseSize(const std::string& value, int& width, int& height) {
+    size_t separator = value.find('x');
+    if (separator == std::string::npos) return false;
+    width = std::stoi(value.substr(0, separator));
+    height = std::stoi(value.substr(separator + 1));
+    return width > 0 && height > 0;
+}
+
+} // namespace
+
+bool parseOptions(const std::vector<std::string>& args,
+                  Options& options,
+                  std::string& error,
+                  std::ostream* log) {
+    Spectrogram::Config& config = options.spec;
+    Pipeline::Config& pipelineConfig = options.pipeline;
+    std::optional<double> endTime;
+    bool hasStartTime = false;
+    bool hasDuration = false;
+    bool hasEndTime = false;
+
+    std::ostringstream discard;
+    std::ostream& out = log ? *log : discard;
+
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string& arg = args[i];
+        if (arg == "-h") {
+            options.help = true;
+            return true;
+        }
+        if (i + 1 >= args.size()) {
+            error = "错误：选项 " + arg + " 需要一个参数";
+            return false;
+        }
+        const std::string& value = args[++i];
+
+        try {
+            if (arg == "-s") {
+                config.samples_per_sec = std::stoi(value);
+                if (config.samples_per_sec <= 0) {
+                    error = "错误：每秒采样数必须为正数";
+                    return false;
+                }
+                out << "设置每秒采样数为: " << config.samples_per_sec << std::endl;
+            }
+            else if (arg == "-l") {
+                config.min_freq = parseFrequency(value);
+                out << "设置最低频率为: " << config.min_freq << " Hz" << std::endl;
+            }
+            else if (arg == "-u") {
+                config.max_freq = parseFrequency(value);
+                out << "设置最高频率为: " << config.max_freq << " Hz" << std::endl;
+            }
+            else if (arg == "-b") {
+                config.start_time = std::stod(value);
+                hasStartTime = true;
+                out << "设置开始时间为: " << config.start_time << " 秒" << std::endl;
+            }
+            else if (arg == "-e") {
+                endTime = std::stod(value);
+                hasEndTime = true;
+                out << "设置结束时间为: " << endTime.value() << " 秒" << std::endl;
+            }
+            else if (arg == "-d") {
+                config.duration = std::stod(value);
+                hasDuration = true;
+                out << "设置持续时间为: " << config.duration << " 秒" << std::endl;
+            }
+            else if (arg == "-c") {
+                if (value == "mono") {
+                    pipelineConfig.channel_mode = ChannelMode::Mono;
+                } else if (value == "channels") {
+                    pipelineConfig.channel_mode = ChannelMode::Channels;
+                } else if (value == "ms") {
+                    pipelineConfig.channel_mode = ChannelMode::MidSide;
+                } else {
+                    error = "错误：未知的声道模式: " + value;
+                    return false;
+                }
+                out << "设置声道模式为: " << value << std::endl;
+            }
+            else if (arg == "--size" || arg == "--preview") {
+                if (!parseSize(value, config.width, config.height)) {
+                    error = "错误：图像尺寸应为 <宽>x<高>: " + value;
+                    return false;
+                }
+                if (arg == "--preview") {
+                    pipelineConfig.preview = true;
+                    out << "启用预览模式，图像尺寸: " << value << std::endl;
+                } else {
+                    pipelineConfig.stream_fit_width = true;
+                    out << "设置图像尺寸为: " << value << std::endl;
+                }
+            }
+            else if (arg == "--max-memory") {
+                long megabytes = std::stol(value);
+                if (megabytes <= 0) {
+                    error = "错误：内存预算必须为正数";
+                    return false;
+                }
+                pipelineConfig.max_memory = static_cast<size_t>(megabytes) << 20;
+                out << "启用流式渲染，内存预算: " << megabytes << " MB" << std::endl;
+            }
+            else if (arg == "--index") {
+                pipelineConfig.index_dir = value;
+                out << "使用指纹索引: " << value << std::endl;
+            }
+            else if (arg == "--multi-res") {
+                std::stringstream sizes(value);
+                std::string size;
+                pipelineConfig.resolution_ffts.clear();
+                while (std::getline(sizes, size, ',')) {
+                    int fftSize = std::stoi(size);
+                    if (fftSize < 16) {
+                        error = "错误：FFT 大小必须不小于 16: " + size;
+                        return false;
+                    }
+                    pipelineConfig.resolution_ffts.push_back(fftSize);
+                }
+                out << "启用多分辨率分析，FFT 大小: " << value << std::endl;
+            }
+            else if (arg == "--decode-threads") {
+                pipelineConfig.decode_threads = std::max(1, std::stoi(value));
+                out << "设置解码线程数为: " << pipelineConfig.decode_threads << std::endl;
+            }
+            else if (arg == "--analyze-threads") {
+                pipelineConfig.analyze_threads = std::max(1, std::stoi(value));
+                out << "设置分析线程数为: " << pipelineConfig.analyze_threads << std::endl;
+            }
+            else if (arg == "--render-threads") {
+                pipelineConfig.render_threads = std::max(1, std::stoi(value));
+                out << "设置渲染线程数为: " << pipelineConfig.render_threads << std::endl;
+            }
+            else if (arg == "--queue-depth") {
+                pipelineConfig.queue_depth = std::max(1, std::stoi(value));
+                out << "设置队列容量为: " << pipelineConfig.queue_depth << std::endl;
+            }
+            else {
+                error = "未知选项: " + arg;
+                return false;
+            }
+        } catch (const std::exception& e) {
+            error = std::string("参数错误: ") + e.what();
+            return false;
+        }
+    }
+
+    if (config.min_freq <= 0 || config.max_freq <= config.min_freq) {
+        error = "错误：频率范围无效";
+        return false;
+    }
+
+    // 流式渲染只使用单一分辨率
+    if (pipelineConfig.max_memory > 0 && !pipelineConfig.preview && !pipelineConfig.resolution_ffts.empty()) {
+        error = "错误：流式渲染（--max-memory）不支持多分辨率分析（--multi-res）";
+        return false;
+    }
+
+    // 检查时间参数的组合
+    int timeParamsCount = hasStartTime + hasDuration + hasEndTime;
+    if (timeParamsCount > 2) {
+        error = "错误：开始时间、结束时间、持续时间只能指定其中两个";
+        return false;
+    }
+
+    // 根据指定的时间参数计算持续时间
+    if (hasEndTime) {
+        if (endTime.value() <= config.start_time) {
+            error = "错误：结束时间必须大于开始时间";
+            return false;
+        }
+        if (!hasDuration) {
+            config.duration = endTime.value() - config.start_time;
+            out << "计算得到持续时间为: " << config.duration << " 秒" << std::endl;
+        }
+    }
+
+    return true;
+}
+
+std::string outputFileFor(const std::string& inputFile, const std::string& outputDir) {
+    fs::path outputFile = fs::path(outputDir) / fs::path(inputFile).filename();
+    outputFile.replace_extension(".png");
+    return outputFile.string();
+}
@@ -0,0 +1,355 @@
+#include "pipeline.hpp"
+#include "lazy_analyzer.hpp"
+#include "stream_renderer.hpp"
+#include "fingerprint.hpp"
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <iomanip>
+#include <cmath>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t kDuplicateCandidates = 4;   // 查找可复用图像时检查的相似录音数
+constexpr double kDuplicateMaxOffset = 0.1;  // 复用图像时两段录音起点的最大差（秒）
+constexpr double kDuplicateMinRatio = 0.9;   // 复用图像时两段录音哈希数之比的下限
+constexpr double kDuplicateLengthTolerance = 0.01;  // 复用图像时时长的相对误差上限
+
+// 两段录音首尾都吻合（而非一段只是另一段的截取）时才能共用一张图像
+bool matchesEndToEnd(const FingerprintIndex::Match& match, size_t hashCount, double duration) {
+    const FingerprintIndex::Entry& entry = *match.entry;
+    const double counts = std::min<double>(hashCount, entry.hash_count) /
+                          std::max<double>(1, std::max<double>(hashCount, entry.hash_count));
+    return std::abs(match.offset) <= kDuplicateMaxOffset && counts >= kDuplicateMinRatio && entry.duration > 0 &&
+           std::abs(entry.duration - duration) <=
+               std::max(kDuplicateMaxOffset, kDuplicateLengthTolerance * std::max(entry.duration, duration));
+}
+
+// 指纹始终取自单声道混音，与 --channels 无关；单声道和中/侧模式下直接使用已分析的结果，
+// 按声道分析时另行分析混音并存入 downmixed
+const Spectrogram::Track& monoTrack(const AudioClip& clip, const std::vector<Spectrogram::Track>& tracks,
+                                    ChannelMode mode, AnalyzerCache& analyzers, const Spectrogram::Config& spec,
+                                    const Pipeline::Config& config, Spectrogram::Track& downmixed) {
+    if (mode == ChannelMode::Mono || clip.channels == 1) return tracks[0];
+    if (mode == ChannelMode::MidSide) return tracks[2];
+
+    std::vector<double> downmix(clip.tracks[0].size());
+    for (size_t i = 0; i < downmix.size(); ++i) {
+        double sum = 0.0;
+        for (int c = 0; c < clip.channels; ++c) sum += clip.tracks[c][i];
+        downmix[i] = sum / clip.channels;
+    }
+    downmixed = analyzers.analyze(downmix, clip.sampleRate, spec, config.fft_size, config.resolution_ffts);
+    return downmixed;
+}
+
+// 多个阶段并发输出日志，整行写出以免交错
+std::mutex logMutex;
+
+void logLine(std::ostream& stream, const std::string& line) {
+    std::lock_guard<std::mutex> lock(logMutex);
+    stream << line << std::endl;
+}
+
+struct DecodedItem {
+    const Pipeline::Job* job = nullptr;
+    AudioClip clip;
+    std::unique_ptr<LazyAnalyzer> lazy;   // 预览模式下只打开文件，由分析阶段读取需要的帧
+};
+
+struct AnalyzedItem {
+    const Pipeline::Job* job = nullptr;
+    int sampleRate = 0;
+    Spectrogram::Config spec;
+    std::vector<Spectrogram::Track> tracks;
+};
+
+// 让 outputFile 指向已有的频谱图，不支持符号链接时复制
+bool linkOutput(const std::string& existing, const std::string& outputFile) {
+    if (fs::absolute(existing) == fs::absolute(outputFile)) return true;
+    std::error_code ec;
+    fs::remove(outputFile, ec);
+    fs::create_symlink(fs::absolute(existing), outputFile, ec);
+    if (ec) {
+        ec.clear();
+        fs::copy_file(existing, outputFile, ec);
+    }
+    return !ec;
+}
+
+// 影响生成图像的选项摘要，索引中的图像只在摘要相同时复用
+std::string renderOptionsDigest(const Pipeline::Config& config, const Spectrogram::Config& spec) {
+    std::ostringstream text;
+    text.precision(17);
+    text << spec.start_time << ' ' << spec.duration << ' ' << spec.samples_per_sec << ' '
+         << spec.min_freq << ' ' << spec.max_freq << ' ' << spec.width << 'x' << spec.height << ' '
+         << config.fft_size << ' ' << static_cast<int>(config.channel_mode);
+    for (int size : config.resolution_ffts) text << ',' << size;
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text.str()) {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    std::ostringstream digest;
+    digest << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return digest.str();
+}
+
+// 启动一组工作线程，最后一个退出的线程负责关闭下游队列
+template <typename Queue, typename Work>
+void launchStage(std::vector<std::thread>& threads, int count, Queue& downstream, Work work) {
+    auto remaining = std::make_shared<std::atomic<int>>(count);
+    for (int i = 0; i < count; ++i) {
+        threads.emplace_back([remaining, &downstream, work] {
+            work();
+            if (remaining->fetch_sub(1) == 1) {
+                downstream.close();
+            }
+        });
+    }
+}
+
+} // namespace
+
+Pipeline::Pipeline(const Config& config, const Spectrogram::Config& specConfig)
+    : config(config), specConfig(specConfig) {}
+
+size_t Pipeline::run(const std::vector<Job>& jobs) {
+    if (config.max_memory > 0 && !config.preview) {
+        return runStreaming(jobs);
+    }
+
+    BoundedQueue<DecodedItem> decoded(config.queue_depth);
+    BoundedQueue<AnalyzedItem> analyzed(config.queue_depth);
+    std::atomic<size_t> nextJob{0};
+    std::atomic<size_t> succeeded{0};
+
+    // 指纹索引在分析阶段的各线程之间共享
+    std::unique_ptr<FingerprintIndex> fingerprints;
+    std::mutex indexMutex;
+    const std::string optionsDigest = renderOptionsDigest(config, specConfig);
+    if (!config.index_dir.empty() && config.preview) {
+        logLine(std::cerr, "警告：预览模式不使用指纹索引，--index 被忽略");
+    }
+    if (!config.index_dir.empty() && !config.preview) {
+        fingerprints = std::make_unique<FingerprintIndex>();
+        std::string error;
+        if (!fingerprints->open(config.index_dir, error)) {
+            logLine(std::cerr, "无法打开指纹索引: " + error);
+            return 0;
+        }
+    }
+
+    std::vector<std::thread> threads;
+
+    // 解码阶段：按顺序领取任务，读取音频并按声道模式拆分；预览模式下只打开文件
+    launchStage(threads, std::max(1, config.decode_threads), decoded, [&] {
+        for (size_t index = nextJob++; index < jobs.size(); index = nextJob++) {
+            const Job& job = jobs[index];
+            DecodedItem item;
+            item.job = &job;
+
+            // 已索引、未修改且以相同选项生成过图像的文件不再处理
+            if (fingerprints) {
+                std::unique_lock<std::mutex> lock(indexMutex);
+                const FingerprintIndex::Entry* entry = fingerprints->find(job.inputFile);
+                if (entry && entry->options == optionsDigest && fingerprints->unchanged(*entry) &&
+                    fs::exists(entry->output_file)) {
+                    std::string existing = entry->output_file;
+                    lock.unlock();
+                    if (linkOutput(existing, job.outputFile)) {
+                        logLine(std::cout, "已在索引中，跳过: " + job.inputFile);
+                        ++succeeded;
+                        continue;
+                    }
+                }
+            }
+
+            std::string error;
+            if (config.preview) {
+                item.lazy = std::make_unique<LazyAnalyzer>();
+                if (!item.lazy->open(job.inputFile, specConfig, config.channel_mode, config.fft_size, error)) {
+                    logLine(std::cerr, "无法打开音频文件: " + job.inputFile + "\n错误信息: " + error);
+                    continue;
+                }
+                if (!decoded.push(std::move(item))) break;
+                continue;
+            }
+
+            if (!decodeAudioFile(job.inputFile, specConfig, config.channel_mode, item.clip, error)) {
+                logLine(std::cerr, "无法打开音频文件: " + job.inputFile + "\n错误信息: " + error);
+                continue;
+            }
+
+            std::ostringstream info;
+            info << "处理文件: " << job.inputFile << "\n"
+                 << "  采样率: " << item.clip.sampleRate << " Hz\n"
+                 << "  声道数: " << item.clip.channels << "\n"
+                 << "  总帧数: " << item.clip.tracks[0].size() << "\n"
+                 << "  分析路数: " << item.clip.tracks.size();
+            logLine(std::cout, info.str());
+
+            if (!decoded.push(std::move(item))) break;
+        }
+    });
+
+    // 分析阶段：FFT 计划跨文件共享，多路信号在各分析线程内并发计算
+    // 各分析线程平分硬件线程，总线程数不超过核心数
+    const int analyzeThreads = std::max(1, config.analyze_threads);
+    const int channelThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / analyzeThreads);
+    launchStage(threads, analyzeThreads, analyzed, [&] {
+        AnalyzerCache analyzers;
+        DecodedItem item;
+        while (decoded.pop(item)) {
+            AnalyzedItem result;
+            result.job = item.job;
+
+            if (item.lazy) {
+                std::string error;
+                if (!item.lazy->preview(specConfig.width, result.tracks, result.spec, error)) {
+                    logLine(std::cerr, "预览失败: " + item.job->inputFile + "\n错误信息: " + error);
+                    continue;
+                }
+                result.sampleRate = item.lazy->getSampleRate();
+
+                std::ostringstream info;
+                info << "生成预览: " << item.job->inputFile << "\n"
+                     << "  计算帧数: " << item.lazy->computedCount() << "/" << item.lazy->frameCount()
+                     << "  图像尺寸: " << result.spec.width << "x" << result.spec.height;
+                logLine(std::cout, info.str());
+
+                item.lazy.reset();
+                if (!analyzed.push(std::move(result))) break;
+                continue;
+            }
+
+            result.sampleRate = item.clip.sampleRate;
+            result.spec = specConfig;
+            result.tracks = analyzers.analyze(item.clip, specConfig, config.fft_size,
+                                              config.resolution_ffts, channelThreads);
+
+            // 用分析得到的帧计算指纹，与已索引的录音完全重复且图像以相同选项生成时链接到该图像；
+            // 只是部分相似（如截取的片段）时照常渲染，在日志中记录相似关系
+            if (fingerprints) {
+                Spectrogram::Track downmixed;
+                auto hashes = computeFingerprint(monoTrack(item.clip, result.tracks, config.channel_mode, analyzers,
+                                                           specConfig, config, downmixed),
+                                                 result.sampleRate);
+                const double duration = static_cast<double>(item.clip.tracks[0].size()) / item.clip.sampleRate;
+                std::lock_guard<std::mutex> lock(indexMutex);
+                // 文件修改后重新索引时不与自己的旧版本比较
+                const FingerprintIndex::Entry* previous = fingerprints->find(item.job->inputFile);
+                auto matches = fingerprints->query(hashes, kDuplicateCandidates, previous ? int64_t(previous->id) : -1);
+                const FingerprintIndex::Match* duplicate = nullptr;
+                for (const auto& match : matches) {
+                    if (match.similarity < config.duplicate_similarity) break;
+                    if (matchesEndToEnd(match, hashes.size(), duration) && match.entry->options == optionsDigest &&
+                        fs::exists(match.entry->output_file)) {
+                        duplicate = &match;
+                        break;
+                    }
+                }
+                if (!duplicate && !matches.empty() && matches[0].coverage >= config.duplicate_similarity) {
+                    std::ostringstream info;
+                    info << "相似录音: " << item.job->inputFile << "\n"
+                         << "  与 " << matches[0].entry->input_file << " 部分重复（覆盖 " << matches[0].coverage
+                         << "，相似度 " << matches[0].similarity << "，偏移 " << matches[0].offset << " 秒），照常渲染";
+                    logLine(std::cout, info.str());
+                }
+                std::string error;
+                if (!fingerprints->add(item.job->inputFile, item.job->outputFile, optionsDigest, hashes, duration,
+                                       error)) {
+                    logLine(std::cerr, "写入指纹索引失败: " + error);
+                }
+                if (duplicate && linkOutput(duplicate->entry->output_file, item.job->outputFile)) {
+                    std::ostringstream info;
+                    info << "重复录音: " << item.job->inputFile << "\n"
+                         << "  相似: " << duplicate->entry->input_file
+                         << "（相似度 " << duplicate->similarity << "，偏移 " << duplicate->offset << " 秒）\n"
+                         << "  已链接到: " << duplicate->entry->output_file;
+                    logLine(std::cout, info.str());
+                    ++succeeded;
+                    continue;
+                }
+            }
+
+            std::ostringstream info;
+            info << "生成频谱图: " << item.job->inputFile << "\n";
+            for (const auto& band : result.tracks[0]) {
+                info << "  FFT大小: " << band.fft_size
+                     << "  跳跃大小: " << band.hop_size
+                     << "  总帧数: " << band.frames.size();
+                if (!band.freqs.empty()) info << "  窄带分析: " << band.freqs.size() << " 个频率";
+                info << "\n";
+            }
+            std::string text = info.str();
+            text.pop_back();
+            logLine(std::cout, text);
+
+            item.clip.tracks = std::vector<std::vector<double>>();
+            if (!analyzed.push(std::move(result))) break;
+        }
+    });
+
+    // 渲染阶段：生成图像并写入 PNG
+    std::vector<std::thread> renderThreads;
+    for (int i = 0; i < std::max(1, config.render_threads); ++i) {
+        renderThreads.emplace_back([&] {
+            Spectrogram spectrogram;
+            AnalyzedItem item;
+            while (analyzed.pop(item)) {
+                if (!spectrogram.generateSpectrogram(item.tracks, item.job->outputFile,
+                                                     item.sampleRate, item.spec)) {
+                    logLine(std::cerr, "无法写入频谱图: " + item.job->outputFile);
+                    continue;
+                }
+                logLine(std::cout, "已生成频谱图: " + item.job->outputFile);
+                ++succeeded;
+            }
+        });
+    }
+
+    for (auto& thread : threads) thread.join();
+    for (auto& thread : renderThreads) thread.join();
+
+    return succeeded;
+}
+
+size_t Pipeline::runStreaming(const std::vector<Job>& jobs) {
+    if (!config.index_dir.empty()) {
+        logLine(std::cerr, "警告：流式渲染不使用指纹索引，--index 被忽略");
+    }
+
+    // 内存预算是整个进程的，因此逐个文件处理
+    StreamingRenderer::Config streamConfig;
+    streamConfig.max_memory = config.max_memory;
+    streamConfig.fft_size = config.fft_size;
+    streamConfig.channel_mode = config.channel_mode;
+    streamConfig.width = config.stream_fit_width ? specConfig.width : 0;
+    StreamingRenderer renderer(streamConfig, specConfig);
+
+    size_t succeeded = 0;
+    for (const Job& job : jobs) {
+        logLine(std::cout, "流式渲染: " + job.inputFile);
+        std::string error;
+        if (!renderer.render(job.inputFile, job.outputFile, error)) {
+            logLine(std::cerr, "流式渲染失败: " + job.inputFile + "\n错误信息: " + error);
+            continue;
+        }
+
+        std::ostringstream info;
+        info << "已生成频谱图: " << job.outputFile << "\n"
+             << "  图像尺寸: " << renderer.getWidth() << "x" << specConfig.height << "\n"
+             << "  临时文件: " << (renderer.getSpilledBytes() >> 20) << " MB";
+        logLine(std::cout, info.str());
+        ++succeeded;
+    }
+    return succeeded;
+}
@@ -0,0 +1,155 @@
+#include "png_stream.hpp"
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+constexpr size_t kChunkSize = 1 << 16;   // 每个 IDAT 块的最大长度
+
+void put32(unsigned char* b, uint32_t x) {
+    b[0] = static_cast<unsigned char>(x >> 24);
+    b[1] = static_cast<unsigned char>(x >> 16);
+    b[2] = static_cast<unsigned char>(x >> 8);
+    b[3] = static_cast<unsigned char>(x);
+}
+
+} // namespace
+
+PngStreamWriter::~PngStreamWriter() {
+    close();
+}
+
+void PngStreamWriter::close() {
+    if (streamReady) {
+        deflateEnd(&stream);
+        streamReady = false;
+    }
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+bool PngStreamWriter::open(const std::string& filename, int width, int height, std::string& error) {
+    close();
+    if (width <= 0 || height <= 0) {
+        error = "无效的图像尺寸";
+        return false;
+    }
+
+    file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        error = "无法创建文件: " + filename;
+        return false;
+    }
+
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        error = "zlib 初始化失败";
+        close();
+        return false;
+    }
+    streamReady = true;
+    ok = true;
+    output.resize(kChunkSize);
+    stream.next_out = output.data();
+    stream.avail_out = static_cast<uInt>(output.size());
+
+    rowBytes = static_cast<size_t>(width) * 3;
+    rowRemaining = 0;
+    rowsRemaining = height;
+
+    static const unsigned char signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
+    unsigned char ihdr[13];
+    put32(ihdr, static_cast<uint32_t>(width));
+    put32(ihdr + 4, static_cast<uint32_t>(height));
+    ihdr[8] = 8;     // 位深度
+    ihdr[9] = 2;     // RGB
+    ihdr[10] = 0;    // 压缩方式
+    ihdr[11] = 0;    // 过滤方式
+    ihdr[12] = 0;    // 不隔行
+    ok = fwrite(signature, 1, sizeof(signature), file) == sizeof(signature) &&
+         writeChunk("IHDR", ihdr, sizeof(ihdr));
+    if (!ok) {
+        error = "写入文件失败: " + filename;
+    }
+    return ok;
+}
+
+bool PngStreamWriter::writeChunk(const char* type, const unsigned char* data, size_t size) {
+    unsigned char header[8];
+    put32(header, static_cast<uint32_t>(size));
+    memcpy(header + 4, type, 4);
+    uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(type), 4);
+    if (size) crc = crc32(crc, data, static_cast<uInt>(size));
+    unsigned char trailer[4];
+    put32(trailer, static_cast<uint32_t>(crc));
+
+    return fwrite(header, 1, 8, file) == 8 &&
+           (size == 0 || fwrite(data, 1, size, file) == size) &&
+           fwrite(trailer, 1, 4, file) == 4;
+}
+
+bool PngStreamWriter::deflateInput(const unsigned char* data, size_t size, int flush) {
+    stream.next_in = const_cast<Bytef*>(data);
+    stream.avail_in = static_cast<uInt>(size);
+    while (true) {
+        int result = deflate(&stream, flush);
+        if (result == Z_STREAM_ERROR) return false;
+
+        // 输出缓冲区写满或压缩结束时写出一个 IDAT 块
+        if (stream.avail_out == 0 || (flush == Z_FINISH && result == Z_STREAM_END)) {
+            size_t produced = output.size() - stream.avail_out;
+            if (produced > 0 && !writeChunk("IDAT", output.data(), produced)) return false;
+            stream.next_out = output.data();
+            stream.avail_out = static_cast<uInt>(output.size());
+        }
+
+        if (flush == Z_FINISH) {
+            if (result == Z_STREAM_END) return true;
+        } else if (stream.avail_in == 0 && stream.avail_out > 0) {
+            return true;
+        }
+    }
+}
+
+bool PngStreamWriter::write(const unsigned char* rgb, size_t size) {
+    while (ok && size > 0) {
+        if (rowRemaining == 0) {
+            if (rowsRemaining == 0) {
+                ok = false;
+                break;
+            }
+            // 每行以过滤类型字节开头
+            static const unsigned char filter = 0;
+            ok = deflateInput(&filter, 1, Z_NO_FLUSH);
+            rowRemaining = rowBytes;
+            --rowsRemaining;
+        }
+        size_t n = size < rowRemaining ? size : rowRemaining;
+        ok = ok && deflateInput(rgb, n, Z_NO_FLUSH);
+        rgb += n;
+        size -= n;
+        rowRemaining -= n;
+    }
+    return ok;
+}
+
+bool PngStreamWriter::finish(std::string& error) {
+    if (!file) {
+        error = "PNG 文件未打开";
+        return false;
+    }
+    if (ok && (rowRemaining != 0 || rowsRemaining != 0)) {
+        error = "图像数据不完整";
+        ok = false;
+    }
+    ok = ok && deflateInput(nullptr, 0, Z_FINISH) && writeChunk("IEND", nullptr, 0);
+    if (fclose(file) != 0) ok = false;
+    file = nullptr;
+    if (!ok && error.empty()) {
+        error = "写入 PNG 失败";
+    }
+    close();
+    return ok;
+}
@@ -0,0 +1,425 @@
+#include "server.hpp"
+#include "analyzer.hpp"
+#include "lazy_analyzer.hpp"
+#include "stream_renderer.hpp"
+#include "options.hpp"
+#include "pipeline.hpp"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+// macOS 没有 MSG_NOSIGNAL，改为忽略 SIGPIPE
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace {
+
+constexpr uint32_t kMaxRequestSize = 1 << 20;     // 请求只包含路径和选项
+constexpr uint32_t kMaxResponseSize = 1u << 30;   // 响应可能包含整张 PNG
+constexpr int kReceiveTimeoutSeconds = 10;        // 请求开始到达后读完整个请求的期限
+
+enum Status : char {
+    kOk = 0,
+    kFailed = 1,
+};
+
+std::atomic<bool> stopRequested{false};
+
+void handleStopSignal(int) {
+    stopRequested = true;
+}
+
+std::mutex logMutex;
+
+bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool readAll(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool writeFrame(int fd, const std::string& payload) {
+    uint32_t size = static_cast<uint32_t>(payload.size());
+    char header[4] = {
+        static_cast<char>(size >> 24), static_cast<char>(size >> 16),
+        static_cast<char>(size >> 8), static_cast<char>(size),
+    };
+    return writeAll(fd, header, 4) && writeAll(fd, payload.data(), payload.size());
+}
+
+bool readFrame(int fd, std::string& payload, uint32_t maxSize) {
+    unsigned char header[4];
+    if (!readAll(fd, reinterpret_cast<char*>(header), 4)) return false;
+    uint32_t size = (uint32_t(header[0]) << 24) | (uint32_t(header[1]) << 16) |
+                    (uint32_t(header[2]) << 8) | uint32_t(header[3]);
+    if (size > maxSize) return false;
+    payload.resize(size);
+    return readAll(fd, &payload[0], size);
+}
+
+std::vector<std::string> splitFields(const std::string& payload) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (start <= payload.size()) {
+        size_t end = payload.find('\0', start);
+        if (end == std::string::npos) end = payload.size();
+        fields.push_back(payload.substr(start, end - start));
+        start = end + 1;
+    }
+    return fields;
+}
+
+// 处理一个请求，返回响应负载
+std::string handleRequest(const std::string& request, AnalyzerCache& analyzers, Spectrogram& spectrogram) {
+    auto failure = [](const std::string& message) {
+        return std::string(1, kFailed) + message;
+    };
+
+    std::vector<std::string> fields = splitFields(request);
+    if (fields.size() < 3 || (fields[0] != "path" && fields[0] != "bytes")) {
+        return failure("无效的请求");
+    }
+    const bool returnBytes = fields[0] == "bytes";
+    const std::string& inputFile = fields[1];
+    const std::string& outputDir = fields[2];
+
+    // 批处理流水线的选项对单个请求没有意义，指纹索引也不能由多个工作线程同时写入
+    for (size_t i = 3; i < fields.size(); i += 2) {
+        if (fields[i] == "--index" || fields[i] == "--decode-threads" || fields[i] == "--analyze-threads" ||
+            fields[i] == "--render-threads" || fields[i] == "--queue-depth") {
+            return failure("服务模式不支持选项: " + fields[i]);
+        }
+        if (fields[i] == "-h") break;
+    }
+
+    Options options;
+    std::string error;
+    if (!parseOptions(std::vector<std::string>(fields.begin() + 3, fields.end()), options, error)) {
+        return failure(error);
+    }
+
+    // 流式渲染直接写出文件，不在内存中保留整张图像
+    if (options.pipeline.max_memory > 0 && !options.pipeline.preview) {
+        if (returnBytes) {
+            return failure("流式渲染只能写入文件");
+        }
+        std::error_code ec;
+        fs::create_directories(outputDir, ec);
+        StreamingRenderer::Config streamConfig;
+        streamConfig.max_memory = options.pipeline.max_memory;
+        streamConfig.fft_size = options.pipeline.fft_size;
+        streamConfig.channel_mode = options.pipeline.channel_mode;
+        streamConfig.width = options.pipeline.stream_fit_width ? options.spec.width : 0;
+        std::string outputFile = outputFileFor(inputFile, outputDir);
+        if (!StreamingRenderer(streamConfig, options.spec).render(inputFile, outputFile, error)) {
+            return failure("流式渲染失败: " + error);
+        }
+        return std::string(1, kOk) + outputFile;
+    }
+
+    std::vector<Spectrogram::Track> tracks;
+    Spectrogram::Config spec = options.spec;
+    int sampleRate = 0;
+    if (options.pipeline.preview) {
+        LazyAnalyzer lazy;
+        if (!lazy.open(inputFile, options.spec, options.pipeline.channel_mode,
+                       options.pipeline.fft_size, error)) {
+            return failure("无法打开音频文件: " + inputFile + ": " + error);
+        }
+        if (!lazy.preview(options.spec.width, tracks, spec, error)) {
+            return failure("预览失败: " + error);
+        }
+        sampleRate = lazy.getSampleRate();
+    } else {
+        AudioClip clip;
+        if (!decodeAudioFile(inputFile, options.spec, options.pipeline.channel_mode, clip, error)) {
+            return failure("无法打开音频文件: " + inputFile + ": " + error);
+        }
+        tracks = analyzers.analyze(clip, options.spec, options.pipeline.fft_size,
+                                   options.pipeline.resolution_ffts);
+        sampleRate = clip.sampleRate;
+    }
+
+    if (returnBytes) {
+        std::vector<unsigned char> png;
+        if (!spectrogram.encodeSpectrogram(tracks, sampleRate, spec, png)) {
+            return failure("PNG 编码失败");
+        }
+        std::string response(1, kOk);
+        response.append(png.begin(), png.end());
+        return response;
+    }
+
+    std::error_code ec;
+    fs::create_directories(outputDir, ec);
+    if (ec) {
+        return failure("创建输出目录失败: " + ec.message());
+    }
+    std::string outputFile = outputFileFor(inputFile, outputDir);
+    if (!spectrogram.generateSpectrogram(tracks, outputFile, sampleRate, spec)) {
+        return failure("无法写入频谱图: " + outputFile);
+    }
+    return std::string(1, kOk) + outputFile;
+}
+
+// 处理连接上已到达的一个请求；返回 false 时连接应关闭
+bool serveRequest(int fd, AnalyzerCache& analyzers, Spectrogram& spectrogram) {
+    std::string request;
+    if (!readFrame(fd, request, kMaxRequestSize)) return false;
+
+    auto start = std::chrono::steady_clock::now();
+    std::string response = handleRequest(request, analyzers, spectrogram);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    {
+        std::vector<std::string> fields = splitFields(request);
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::cout << (response[0] == kOk ? "完成: " : "失败: ")
+                  << (fields.size() > 1 ? fields[1] : "") << " (" << elapsed.count() << " ms)";
+        if (response[0] != kOk) std::cout << " " << response.substr(1);
+        std::cout << std::endl;
+    }
+
+    return writeFrame(fd, response);
+}
+
+// 所有工作线程都在忙时拒绝请求，不阻塞接收新连接
+void rejectBusy(int fd) {
+    writeFrame(fd, std::string(1, kFailed) + "服务繁忙，请稍后重试");
+    close(fd);
+}
+
+} // namespace
+
+SpectrumServer::SpectrumServer(const Config& config) : config(config) {}
+
+void SpectrumServer::stop() {
+    stopRequested = true;
+}
+
+bool SpectrumServer::run(std::string& error) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (config.socket_path.empty() || config.socket_path.size() >= sizeof(address.sun_path)) {
+        error = "套接字路径无效: " + config.socket_path;
+        return false;
+    }
+    strncpy(address.sun_path, config.socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        error = std::string("创建套接字失败: ") + strerror(errno);
+        return false;
+    }
+
+    // 清理上次运行残留的套接字文件；路径上是其他文件或已有服务在监听时拒绝启动，以免误删
+    struct stat existing;
+    if (lstat(config.socket_path.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            error = "套接字路径已被其他文件占用: " + config.socket_path;
+            close(listener);
+            return false;
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe < 0) {
+            error = std::string("创建套接字失败: ") + strerror(errno);
+            close(listener);
+            return false;
+        }
+        int connected = connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        int probeErrno = errno;
+        close(probe);
+        if (connected == 0) {
+            error = "服务已在运行: " + config.socket_path;
+            close(listener);
+            return false;
+        }
+        if (probeErrno != ECONNREFUSED) {
+            error = "无法确认套接字是否仍在使用: " + config.socket_path + ": " + strerror(probeErrno);
+            close(listener);
+            return false;
+        }
+        unlink(config.socket_path.c_str());
+    }
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(listener, SOMAXCONN) < 0) {
+        error = std::string("监听套接字失败: ") + strerror(errno);
+        close(listener);
+        return false;
+    }
+
+    stopRequested = false;
+    std::signal(SIGINT, handleStopSignal);
+    std::signal(SIGTERM, handleStopSignal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    int workers = config.workers > 0
+        ? config.workers
+        : std::max(1u, std::thread::hardware_concurrency());
+    BoundedQueue<int> connections(workers * 4);
+
+    // 工作线程处理完一个请求后把连接交还给主线程，由主线程等待下一个请求，
+    // 空闲的客户端因此不占用工作线程。交还时写管道唤醒 poll。
+    int wake[2];
+    if (pipe(wake) < 0) {
+        error = std::string("创建管道失败: ") + strerror(errno);
+        close(listener);
+        unlink(config.socket_path.c_str());
+        return false;
+    }
+    fcntl(wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake[1], F_SETFL, O_NONBLOCK);
+    std::mutex returnedMutex;
+    std::vector<int> returned;
+
+    // 工作线程各自持有常驻的 FFT 计划和渲染器
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; ++i) {
+        threads.emplace_back([&] {
+            AnalyzerCache analyzers;
+            Spectrogram spectrogram;
+            int fd;
+            while (connections.pop(fd)) {
+                if (!serveRequest(fd, analyzers, spectrogram)) {
+                    close(fd);
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(returnedMutex);
+                returned.push_back(fd);
+                char byte = 0;
+                ssize_t ignored = write(wake[1], &byte, 1);
+                (void)ignored;
+            }
+        });
+    }
+
+    std::cout << "服务已启动: " << config.socket_path << "（" << workers << " 个工作线程）" << std::endl;
+
+    std::vector<int> idle;   // 等待下一个请求的连接
+    while (!stopRequested) {
+        std::vector<pollfd> pfds = {{listener, POLLIN, 0}, {wake[0], POLLIN, 0}};
+        for (int fd : idle) pfds.push_back({fd, POLLIN, 0});
+        int ready = poll(pfds.data(), pfds.size(), 200);
+        if (ready <= 0) continue;
+
+        // 有数据（或已关闭）的连接交给工作线程，读到 EOF 后由工作线程关闭
+        std::vector<int> waiting;
+        for (size_t i = 2; i < pfds.size(); ++i) {
+            if (pfds[i].revents == 0) {
+                waiting.push_back(pfds[i].fd);
+            } else if (!connections.tryPush(pfds[i].fd)) {
+                rejectBusy(pfds[i].fd);
+            }
+        }
+        idle.swap(waiting);
+
+        if (pfds[1].revents & POLLIN) {
+            char buffer[64];
+            while (read(wake[0], buffer, sizeof(buffer)) > 0) {}
+            std::lock_guard<std::mutex> lock(returnedMutex);
+            idle.insert(idle.end(), returned.begin(), returned.end());
+            returned.clear();
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) continue;
+            // 请求开始到达后限时读完，半个请求不会一直占用工作线程
+            timeval timeout = {kReceiveTimeoutSeconds, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            idle.push_back(fd);
+        }
+    }
+
+    connections.close();
+    for (auto& thread : threads) thread.join();
+    for (int fd : idle) close(fd);
+    for (int fd : returned) close(fd);
+    close(wake[0]);
+    close(wake[1]);
+    close(listener);
+    unlink(config.socket_path.c_str());
+    std::cout << "服务已停止" << std::endl;
+    return true;
+}
+
+bool sendServerRequest(const std::string& socketPath,
+                       bool returnBytes,
+                       const std::string& inputFile,
+                       const std::string& outputDir,
+                       const std::vector<std::string>& options,
+                       std::string& result,
+                       std::string& error) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+        error = "套接字路径无效: " + socketPath;
+        return false;
+    }
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    std::signal(SIGPIPE, SIG_IGN);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        error = std::string("无法连接服务: ") + strerror(errno);
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    std::string request = returnBytes ? "bytes" : "path";
+    request += '\0' + inputFile + '\0' + outputDir;
+    for (const auto& option : options) {
+        request += '\0' + option;
+    }
+
+    // 服务繁忙时可能在读取请求之前就回复并关闭连接，因此发送失败时仍读取响应
+    std::string response;
+    writeFrame(fd, request);
+    bool ok = readFrame(fd, response, kMaxResponseSize) && !response.empty();
+    close(fd);
+    if (!ok) {
+        error = "与服务通信失败";
+        return false;
+    }
+
+    if (response[0] != kOk) {
+        error = response.substr(1);
+        return false;
+    }
+    result = response.substr(1);
+    return true;
+}
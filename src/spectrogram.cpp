@@ -1,5 +1,7 @@
 #include "spectrogram.hpp"
+#include "note_utils.hpp"
 #include <cmath>
+#include <cstring>
 #include <algorithm>
 
 #ifdef __APPLE__
@@ -7,28 +9,230 @@
 #else
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#include "note_overlay.hpp"
 #endif
 
-void Spectrogram::generateSpectrogram(const std::vector<std::vector<double>>& specData,
+namespace {
+
+// 将频谱强度转换为颜色：从蓝到红，强度越高越亮
+void intensityToRgb(double intensity, double& r, double& g, double& b) {
+    double hue = 0.7 * (1.0 - std::min(1.0, intensity));
+
+    // HSV to RGB 转换
+    double h = hue * 6.0;
+    double s = 1.0;
+    double v = std::min(1.0, intensity * 2.0);
+
+    int i = static_cast<int>(h);
+    double f = h - i;
+    double p = v * (1 - s);
+    double q = v * (1 - s * f);
+    double t = v * (1 - s * (1 - f));
+
+    switch (i % 6) {
+        case 0: r = v; g = t; b = p; break;
+        case 1: r = q; g = v; b = p; break;
+        case 2: r = p; g = v; b = t; break;
+        case 3: r = p; g = q; b = v; break;
+        case 4: r = t; g = p; b = v; break;
+        case 5: r = v; g = p; b = q; break;
+        default: r = g = b = 0; break;
+    }
+}
+
+} // namespace
+
+bool Spectrogram::generateSpectrogram(const std::vector<std::vector<double>>& specData,
+                                    const std::string& outputFile,
+                                    int sampleRate,
+                                    const Config& config) {
+    std::vector<Track> tracks(1, Track(1));
+    Band& band = tracks[0][0];
+    band.fft_size = specData.empty() ? 2 : static_cast<int>(specData[0].size() - 1) * 2;
+    band.hop_size = std::max(1, sampleRate / config.samples_per_sec);
+    band.frames = specData;
+    return generateSpectrogram(tracks, outputFile, sampleRate, config);
+}
+
+bool Spectrogram::generateSpectrogram(const std::vector<Track>& tracks,
                                     const std::string& outputFile,
                                     int sampleRate,
                                     const Config& config) {
-    const int width = 3200;  // 默认宽度
-    const int height = 2400; // 默认高度
+    const int width = config.width;
+    const int height = config.height;
 
 #ifdef __APPLE__
-    generateImageCG(specData, outputFile, width, height, config.min_freq, config.max_freq, sampleRate);
+    return generateImageCG(tracks, outputFile, width, height, sampleRate, config);
 #else
-    generateImageStb(specData, outputFile, width, height, config.min_freq, config.max_freq, sampleRate);
+    return generateImageStb(tracks, outputFile, width, height, sampleRate, config);
 #endif
 }
 
+bool Spectrogram::encodeSpectrogram(const std::vector<Track>& tracks,
+                                    int sampleRate,
+                                    const Config& config,
+                                    std::vector<unsigned char>& png) {
+    const int width = config.width;
+    const int height = config.height;
+
+    png.clear();
 #ifdef __APPLE__
-void Spectrogram::generateImageCG(const std::vector<std::vector<double>>& data,
-                                 const std::string& outputFile,
-                                 int width, int height,
-                                 double minFreq, double maxFreq,
-                                 int sampleRate) {
+    CGImageRef image = createImageCG(tracks, width, height, sampleRate, config);
+    CFMutableDataRef data = CFDataCreateMutable(nullptr, 0);
+    CGImageDestinationRef destination = CGImageDestinationCreateWithData(data, kUTTypePNG, 1, nullptr);
+    CGImageDestinationAddImage(destination, image, nullptr);
+    bool ok = CGImageDestinationFinalize(destination);
+    if (ok) {
+        const UInt8* bytes = CFDataGetBytePtr(data);
+        png.assign(bytes, bytes + CFDataGetLength(data));
+    }
+    CFRelease(destination);
+    CFRelease(data);
+    CGImageRelease(image);
+    return ok;
+#else
+    std::vector<unsigned char> imageData(width * height * 3, 0);
+    renderTracks(tracks, sampleRate, config, width, height, imageData.data(), width * 3);
+    NoteOverlay::get(width, height, std::max<int>(1, tracks.size()), config.min_freq, config.max_freq)
+        ->blend(imageData.data(), width * 3);
+
+    auto append = [](void* context, void* data, int size) {
+        auto* out = static_cast<std::vector<unsigned char>*>(context);
+        auto* bytes = static_cast<unsigned char*>(data);
+        out->insert(out->end(), bytes, bytes + size);
+    };
+    return stbi_write_png_to_func(append, &png, width, height, 3, imageData.data(), width * 3) != 0;
+#endif
+}
+
+void Spectrogram::renderPixels(const Track& bands,
+                               int sampleRate, const Config& config,
+                               int width, int height,
+                               unsigned char* pixels, size_t stride) {
+    for (int y = 0; y < height; ++y) {
+        memset(pixels + y * stride, 0, width * 3);
+    }
+
+    const int baseHop = std::max(1, sampleRate / config.samples_per_sec);
+    const std::vector<RowSource> rows = mapRows(bands, sampleRate, config, height);
+
+    // 第 x 列对应时间 x * baseHop，各频段取时间上最近的一帧
+    std::vector<const std::vector<double>*> columns(bands.size());
+    for (int x = 0; x < width; ++x) {
+        bool hasData = false;
+        for (size_t b = 0; b < bands.size(); ++b) {
+            size_t frame = static_cast<size_t>(static_cast<double>(x) * baseHop / bands[b].hop_size + 0.5);
+            columns[b] = frame < bands[b].frames.size() ? &bands[b].frames[frame] : nullptr;
+            hasData = hasData || columns[b];
+        }
+        if (!hasData) break;
+
+        for (int y = 0; y < height; ++y) {
+            const RowSource& row = rows[y];
+            if (row.band < 0 || !columns[row.band]) continue;
+
+            const std::vector<double>& column = *columns[row.band];
+            double intensity = *std::max_element(column.begin() + row.lo, column.begin() + row.hi + 1);
+
+            intensityColor(intensity, pixels + y * stride + x * 3);
+        }
+    }
+}
+
+std::vector<Spectrogram::RowSource> Spectrogram::mapRows(const Track& bands, int sampleRate,
+                                                         const Config& config, int height) {
+    const double minFreq = config.min_freq;
+    const double maxFreq = config.max_freq;
+
+    std::vector<RowSource> rows(height);
+    for (int y = 0; y < height; ++y) {
+        double level = height - 1 - y;  // 自底向上的行号
+        double freqLo = yToFreq(level, height, minFreq, maxFreq);
+        double freqHi = yToFreq(level + 1, height, minFreq, maxFreq);
+        double freqMid = yToFreq(level + 0.5, height, minFreq, maxFreq);
+        if (freqMid > sampleRate / 2.0) continue;
+
+        for (size_t b = 0; b < bands.size(); ++b) {
+            const Band& band = bands[b];
+            if (freqMid < band.min_freq || freqMid >= band.max_freq || band.frames.empty()) continue;
+
+            int lastBin = static_cast<int>(band.frames[0].size()) - 1;
+            rows[y].band = static_cast<int>(b);
+
+            // 窄带分析的频率不等间隔，同样取行内的最大值或最近的一个
+            if (!band.freqs.empty()) {
+                auto first = std::lower_bound(band.freqs.begin(), band.freqs.end(), freqLo);
+                auto last = std::lower_bound(first, band.freqs.end(), freqHi);
+                if (first == last) {
+                    auto nearest = std::lower_bound(band.freqs.begin(), band.freqs.end(), freqMid);
+                    if (nearest == band.freqs.end() ||
+                        (nearest != band.freqs.begin() && freqMid - *(nearest - 1) < *nearest - freqMid)) {
+                        --nearest;
+                    }
+                    first = nearest;
+                    last = nearest + 1;
+                }
+                rows[y].lo = std::clamp(static_cast<int>(first - band.freqs.begin()), 0, lastBin);
+                rows[y].hi = std::clamp(static_cast<int>(last - band.freqs.begin()) - 1, 0, lastBin);
+                break;
+            }
+
+            // 行内有多个 bin 时取最大值，一个都没有时取最近的 bin
+            double binHz = static_cast<double>(sampleRate) / band.fft_size;
+            int lo = static_cast<int>(std::ceil(freqLo / binHz));
+            int hi = static_cast<int>(std::floor(freqHi / binHz));
+            if (hi < lo) lo = hi = static_cast<int>(std::lround(freqMid / binHz));
+
+            rows[y].lo = std::clamp(lo - band.first_bin, 0, lastBin);
+            rows[y].hi = std::clamp(hi - band.first_bin, 0, lastBin);
+            break;
+        }
+    }
+    return rows;
+}
+
+void Spectrogram::intensityColor(double intensity, unsigned char* rgb) {
+    double r, g, b;
+    intensityToRgb(intensity, r, g, b);
+    rgb[0] = static_cast<unsigned char>(r * 255);
+    rgb[1] = static_cast<unsigned char>(g * 255);
+    rgb[2] = static_cast<unsigned char>(b * 255);
+}
+
+void Spectrogram::renderTracks(const std::vector<Track>& tracks,
+                               int sampleRate, const Config& config,
+                               int width, int height,
+                               unsigned char* pixels, size_t stride) {
+    if (tracks.empty()) {
+        for (int y = 0; y < height; ++y) {
+            memset(pixels + y * stride, 0, width * 3);
+        }
+        return;
+    }
+
+    const int numTracks = static_cast<int>(tracks.size());
+    for (int t = 0; t < numTracks; ++t) {
+        int top = height * t / numTracks;
+        int bottom = height * (t + 1) / numTracks;
+        renderPixels(tracks[t], sampleRate, config, width, bottom - top, pixels + top * stride, stride);
+
+        if (t > 0) {
+            memset(pixels + top * stride, 128, width * 3);
+        }
+    }
+}
+
+#ifdef __APPLE__
+CGImageRef Spectrogram::createImageCG(const std::vector<Track>& tracks,
+                                      int width, int height,
+                                      int sampleRate, const Config& config) {
+    const double minFreq = config.min_freq;
+    const double maxFreq = config.max_freq;
+
+    // 渲染频谱像素
+    std::vector<unsigned char> pixels(width * height * 3);
+    renderTracks(tracks, sampleRate, config, width, height, pixels.data(), width * 3);
+
     // 创建颜色空间
     CGColorSpaceRef colorSpace = CGColorSpaceCreateWithName(kCGColorSpaceGenericRGB);
     
@@ -40,49 +244,17 @@ void Spectrogram::generateImageCG(const std::vector<std::vector<double>>& data,
                                                colorSpace,
                                                kCGImageAlphaPremultipliedLast);
     
-    // 设置背景为黑色
-    CGContextSetRGBFillColor(context, 0, 0, 0, 1);
-    CGContextFillRect(context, CGRectMake(0, 0, width, height));
-    
     // 绘制频谱数据
-    for (size_t x = 0; x < data.size() && x < width; ++x) {
-        for (size_t y = 0; y < data[x].size(); ++y) {
-            double freq = y * sampleRate / 2.0 / data[x].size();
-            if (freq < minFreq || freq > maxFreq) continue;
-            
-            int pixelY = height - 1 - static_cast<int>(freqToY(freq, height, minFreq, maxFreq));
-            if (pixelY < 0 || pixelY >= height) continue;
-            
-            // 将频谱数据转换为颜色
-            double intensity = data[x][y];
-            double hue = 0.7 * (1.0 - std::min(1.0, intensity)); // 从蓝到红
-            
-            // HSV to RGB 转换
-            double h = hue * 6.0;
-            double s = 1.0;
-            double v = std::min(1.0, intensity * 2.0);
-            
-            double r, g, b;
-            int i = static_cast<int>(h);
-            double f = h - i;
-            double p = v * (1 - s);
-            double q = v * (1 - s * f);
-            double t = v * (1 - s * (1 - f));
-            
-            switch (i % 6) {
-                case 0: r = v; g = t; b = p; break;
-                case 1: r = q; g = v; b = p; break;
-                case 2: r = p; g = v; b = t; break;
-                case 3: r = p; g = q; b = v; break;
-                case 4: r = t; g = p; b = v; break;
-                case 5: r = v; g = p; b = q; break;
-                default: r = g = b = 0; break;
-            }
-            
-            CGContextSetRGBFillColor(context, r, g, b, 1);
-            CGContextFillRect(context, CGRectMake(x, pixelY, 1, 1));
-        }
-    }
+    CGDataProviderRef provider = CGDataProviderCreateWithData(nullptr, pixels.data(), pixels.size(), nullptr);
+    CGImageRef specImage = CGImageCreate(width, height,
+                                         8, 24, width * 3,
+                                         colorSpace,
+                                         static_cast<CGBitmapInfo>(kCGImageAlphaNone),
+                                         provider, nullptr, false,
+                                         kCGRenderingIntentDefault);
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), specImage);
+    CGImageRelease(specImage);
+    CGDataProviderRelease(provider);
     
     // 添加音符标注
     CGContextSetRGBStrokeColor(context, 1, 1, 1, 0.5); // 白色，半透明
@@ -93,31 +265,49 @@ void Spectrogram::generateImageCG(const std::vector<std::vector<double>>& data,
     CGContextSetRGBFillColor(context, 1, 1, 1, 1);
     CGContextSetTextDrawingMode(context, kCGTextFill);
     
-    // 绘制音符刻度
-    for (int octave = 1; octave <= 8; ++octave) {
-        const char* notes[] = {"C", "D", "E", "F", "G", "A", "B"};
-        for (const char* note : notes) {
-            std::string noteStr = std::string(note) + std::to_string(octave);
-            double freq = 440.0 * std::pow(2.0, (getNoteAndOctave(noteStr).first - 69) / 12.0);
-            if (freq >= minFreq && freq <= maxFreq) {
-                int y = height - 1 - static_cast<int>(freqToY(freq, height, minFreq, maxFreq));
-                
-                // 绘制横线
-                CGContextMoveToPoint(context, 0, y);
-                CGContextAddLineToPoint(context, width, y);
-                CGContextStrokePath(context);
-                
-                // 绘制文本
-                CGContextSaveGState(context);
-                CGContextTranslateCTM(context, 5, y - 6);
-                CGContextShowText(context, noteStr.c_str(), noteStr.length());
-                CGContextRestoreGState(context);
+    // 绘制音符刻度（Core Graphics 坐标原点在左下角），多路频谱时每一路单独标注
+    const int numPanels = std::max<int>(1, tracks.size());
+    for (int panel = 0; panel < numPanels; ++panel) {
+        int top = height * panel / numPanels;
+        int bottom = height * (panel + 1) / numPanels;
+        int base = height - bottom;
+        int panelHeight = bottom - top;
+
+        for (int octave = 1; octave <= 8; ++octave) {
+            const char* notes[] = {"C", "D", "E", "F", "G", "A", "B"};
+            for (const char* note : notes) {
+                std::string noteStr = std::string(note) + std::to_string(octave);
+                double freq = noteToFreq(noteStr);
+                if (freq >= minFreq && freq <= maxFreq) {
+                    int y = base + static_cast<int>(freqToY(freq, panelHeight, minFreq, maxFreq));
+                    
+                    // 绘制横线
+                    CGContextMoveToPoint(context, 0, y);
+                    CGContextAddLineToPoint(context, width, y);
+                    CGContextStrokePath(context);
+                    
+                    // 绘制文本
+                    CGContextSaveGState(context);
+                    CGContextTranslateCTM(context, 5, y - 6);
+                    CGContextShowText(context, noteStr.c_str(), noteStr.length());
+                    CGContextRestoreGState(context);
+                }
             }
         }
     }
     
     // 创建图像
     CGImageRef image = CGBitmapContextCreateImage(context);
+    CGContextRelease(context);
+    CGColorSpaceRelease(colorSpace);
+    return image;
+}
+
+bool Spectrogram::generateImageCG(const std::vector<Track>& tracks,
+                                 const std::string& outputFile,
+                                 int width, int height,
+                                 int sampleRate, const Config& config) {
+    CGImageRef image = createImageCG(tracks, width, height, sampleRate, config);
     
     // 创建URL
     CFURLRef url = CFURLCreateFromFileSystemRepresentation(nullptr,
@@ -131,72 +321,41 @@ void Spectrogram::generateImageCG(const std::vector<std::vector<double>>& data,
                                                                        1,
                                                                        nullptr);
     
+    if (!destination) {
+        CFRelease(url);
+        CGImageRelease(image);
+        return false;
+    }
+    
     // 添加图像到目标
     CGImageDestinationAddImage(destination, image, nullptr);
     
     // 完成图像写入
-    CGImageDestinationFinalize(destination);
+    bool written = CGImageDestinationFinalize(destination);
     
     // 清理资源
     CFRelease(destination);
     CFRelease(url);
     CGImageRelease(image);
-    CGContextRelease(context);
-    CGColorSpaceRelease(colorSpace);
+    return written;
 }
 #else
-void Spectrogram::generateImageStb(const std::vector<std::vector<double>>& data,
+bool Spectrogram::generateImageStb(const std::vector<Track>& tracks,
                                   const std::string& outputFile,
                                   int width, int height,
-                                  double minFreq, double maxFreq,
-                                  int sampleRate) {
+                                  int sampleRate, const Config& config) {
     // 创建图像数据
     std::vector<unsigned char> imageData(width * height * 3, 0);
     
     // 绘制频谱数据
-    for (size_t x = 0; x < data.size() && x < width; ++x) {
-        for (size_t y = 0; y < data[x].size(); ++y) {
-            double freq = y * sampleRate / 2.0 / data[x].size();
-            if (freq < minFreq || freq > maxFreq) continue;
-            
-            int pixelY = height - 1 - static_cast<int>(freqToY(freq, height, minFreq, maxFreq));
-            if (pixelY < 0 || pixelY >= height) continue;
-            
-            // 将频谱数据转换为颜色
-            double intensity = data[x][y];
-            double hue = 0.7 * (1.0 - std::min(1.0, intensity)); // 从蓝到红
-            
-            // HSV to RGB 转换
-            double h = hue * 6.0;
-            double s = 1.0;
-            double v = std::min(1.0, intensity * 2.0);
-            
-            double r, g, b;
-            int i = static_cast<int>(h);
-            double f = h - i;
-            double p = v * (1 - s);
-            double q = v * (1 - s * f);
-            double t = v * (1 - s * (1 - f));
-            
-            switch (i % 6) {
-                case 0: r = v; g = t; b = p; break;
-                case 1: r = q; g = v; b = p; break;
-                case 2: r = p; g = v; b = t; break;
-                case 3: r = p; g = q; b = v; break;
-                case 4: r = t; g = p; b = v; break;
-                case 5: r = v; g = p; b = q; break;
-                default: r = g = b = 0; break;
-            }
-            
-            int idx = (pixelY * width + x) * 3;
-            imageData[idx] = static_cast<unsigned char>(r * 255);
-            imageData[idx + 1] = static_cast<unsigned char>(g * 255);
-            imageData[idx + 2] = static_cast<unsigned char>(b * 255);
-        }
-    }
+    renderTracks(tracks, sampleRate, config, width, height, imageData.data(), width * 3);
+
+    // 添加音符标注，同样尺寸和频率范围的图像共用一个缓存的叠加层
+    NoteOverlay::get(width, height, std::max<int>(1, tracks.size()), config.min_freq, config.max_freq)
+        ->blend(imageData.data(), width * 3);
     
     // 保存图像
-    stbi_write_png(outputFile.c_str(), width, height, 3, imageData.data(), width * 3);
+    return stbi_write_png(outputFile.c_str(), width, height, 3, imageData.data(), width * 3) != 0;
 }
 #endif
 
@@ -208,6 +367,13 @@ double Spectrogram::freqToY(double freq, int height, double minFreq, double maxF
     return height * (logFreq - logMin) / (logMax - logMin);
 }
 
+double Spectrogram::yToFreq(double y, int height, double minFreq, double maxFreq) {
+    // freqToY 的反函数
+    double logMin = std::log2(minFreq);
+    double logMax = std::log2(maxFreq);
+    return std::exp2(logMin + (logMax - logMin) * y / height);
+}
+
 std::pair<std::string, int> Spectrogram::getNoteAndOctave(double freq) {
     // MIDI音符号到音符名的转换
     static const char* noteNames[] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
@@ -0,0 +1,300 @@
+#include "stream_renderer.hpp"
+#include "png_stream.hpp"
+#include "note_overlay.hpp"
+#include <sndfile.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+constexpr sf_count_t kChunkFrames = 65536;      // 每次解码的帧数
+constexpr size_t kSegmentColumns = 16384;       // 每次着色并送入编码器的列数
+constexpr size_t kEncoderBytes = size_t(1) << 20;  // zlib 状态和输出缓冲区的估计占用
+
+// 临时文件，关闭时自动删除
+struct SpillFile {
+    FILE* file = nullptr;
+    ~SpillFile() {
+        if (file) fclose(file);
+    }
+};
+
+} // namespace
+
+StreamingRenderer::StreamingRenderer(const Config& config, const Spectrogram::Config& specConfig)
+    : config(config), specConfig(specConfig) {}
+
+bool StreamingRenderer::render(const std::string& inputFile, const std::string& outputFile,
+                               std::string& error) {
+    width = 0;
+    spilledBytes = 0;
+
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    SNDFILE* file = sf_open(inputFile.c_str(), SFM_READ, &info);
+    if (!file) {
+        error = sf_strerror(nullptr);
+        return false;
+    }
+    struct FileCloser {
+        SNDFILE* file;
+        ~FileCloser() { sf_close(file); }
+    } closer{file};
+
+    AudioClip chunk;
+    if (!initAudioClip(info.channels, info.samplerate, config.channel_mode, chunk, error)) {
+        return false;
+    }
+    const size_t numTracks = chunk.tracks.size();
+    const int sampleRate = info.samplerate;
+    const int fftSize = config.fft_size;
+
+    // 与 decodeAudioFile 相同的读取范围
+    sf_count_t startFrame = std::clamp<sf_count_t>(
+        static_cast<sf_count_t>(specConfig.start_time * sampleRate), 0, info.frames);
+    sf_count_t numSamples = info.frames - startFrame;
+    if (specConfig.duration > 0) {
+        numSamples = std::min(numSamples, static_cast<sf_count_t>(specConfig.duration * sampleRate));
+    }
+    if (startFrame > 0 && sf_seek(file, startFrame, SEEK_SET) < 0) {
+        error = sf_strerror(file);
+        return false;
+    }
+
+    // 与 StftAnalyzer::compute 相同的分帧方式；未指定宽度时每帧一列
+    const int hopSize = std::max(1, sampleRate / specConfig.samples_per_sec);
+    const uint64_t numFrames = numSamples <= fftSize
+        ? 1
+        : static_cast<uint64_t>(numSamples - fftSize) / hopSize + 1;
+    if (config.width <= 0 && numFrames > static_cast<uint64_t>(INT_MAX)) {
+        error = "图像宽度超出 PNG 的限制，请降低每秒采样数";
+        return false;
+    }
+    const size_t columns = config.width > 0 ? static_cast<size_t>(config.width) : static_cast<size_t>(numFrames);
+    const int height = specConfig.height;
+    width = static_cast<int>(columns);
+
+    // 第 frame 帧覆盖的列 [firstColumn(frame), firstColumn(frame + 1)) 至少一列，
+    // 帧多于列时多个帧落在同一列，取最大值
+    auto firstColumn = [&](uint64_t frame) {
+        return static_cast<size_t>(frame * columns / numFrames);
+    };
+    auto lastColumn = [&](uint64_t frame) {
+        size_t end = static_cast<size_t>((frame + 1) * columns + numFrames - 1) / numFrames;
+        return std::max(firstColumn(frame), end - 1);
+    };
+
+    // 各路信号自上而下堆叠，与 Spectrogram::renderTracks 的布局相同
+    Spectrogram::Band layout;
+    layout.fft_size = fftSize;
+    layout.hop_size = hopSize;
+    layout.frames.assign(1, std::vector<double>(fftSize / 2 + 1));
+    std::vector<int> panelTop(numTracks + 1);
+    std::vector<std::vector<Spectrogram::RowSource>> panelRows(numTracks);
+    for (size_t t = 0; t <= numTracks; ++t) {
+        panelTop[t] = static_cast<int>(height * t / numTracks);
+    }
+    for (size_t t = 0; t < numTracks; ++t) {
+        panelRows[t] = spectrogram.mapRows(Spectrogram::Track(1, layout), sampleRate, specConfig,
+                                           panelTop[t + 1] - panelTop[t]);
+    }
+
+    // 内存预算：扣除解码、分析和编码的固定开销后，剩余部分用于列块或行条带
+    const size_t fixedBytes = kChunkFrames * info.channels * sizeof(double)
+                            + numTracks * (2 * kChunkFrames + fftSize) * sizeof(double) * 2
+                            + kSegmentColumns * 3 + kEncoderBytes
+                            + static_cast<size_t>(height) * sizeof(Spectrogram::RowSource);
+    const size_t minimumBytes = fixedBytes + static_cast<size_t>(height) * 2;
+    if (config.max_memory < minimumBytes) {
+        error = "内存预算过小，至少需要 " + std::to_string((minimumBytes >> 20) + 1) + " MB";
+        return false;
+    }
+    const size_t available = config.max_memory - fixedBytes;
+    const bool spill = columns > available / height;
+    const size_t tileColumns = spill ? std::max<size_t>(1, available / 2 / height) : columns;
+
+    SpillFile spillFile;
+    if (spill) {
+        spillFile.file = std::tmpfile();
+        if (!spillFile.file) {
+            error = "无法创建临时文件";
+            return false;
+        }
+    }
+
+    // 分析：逐块解码，凑够一帧的采样就计算并写入它覆盖的列
+    StftAnalyzer& analyzer = analyzers.get(fftSize);
+    std::vector<unsigned char> tile(tileColumns * height);
+    std::vector<unsigned char> column(height);
+    size_t tileIndex = 0;         // 当前列块
+    size_t nextColumn = 0;        // 尚未写入任何帧的第一列
+    auto flushTile = [&] {
+        const size_t tileWidth = std::min(tileColumns, columns - tileIndex * tileColumns);
+        size_t bytes = tileWidth * height;
+        if (fwrite(tile.data(), 1, bytes, spillFile.file) != bytes) {
+            error = "写入临时文件失败";
+            return false;
+        }
+        spilledBytes += bytes;
+        ++tileIndex;
+        return true;
+    };
+    sf_count_t pendingStart = 0;   // pending 中第一个采样在片段中的位置
+    std::vector<std::vector<double>> pending(numTracks);
+    std::vector<double> buffer(kChunkFrames * info.channels);
+    sf_count_t received = 0;
+    bool endOfFile = false;
+
+    for (uint64_t frame = 0; frame < numFrames; ) {
+        const sf_count_t offset = static_cast<sf_count_t>(frame) * hopSize;
+        const sf_count_t end = std::min<sf_count_t>(offset + fftSize, numSamples);
+        if (received < end && !endOfFile) {
+            sf_count_t got = sf_readf_double(file, buffer.data(), std::min(kChunkFrames, numSamples - received));
+            if (got <= 0) {
+                endOfFile = true;
+                continue;
+            }
+            initAudioClip(info.channels, sampleRate, config.channel_mode, chunk, error);
+            appendAudioFrames(buffer.data(), static_cast<size_t>(got), config.channel_mode, chunk);
+            for (size_t t = 0; t < numTracks; ++t) {
+                pending[t].insert(pending[t].end(), chunk.tracks[t].begin(), chunk.tracks[t].end());
+            }
+            received += got;
+            continue;
+        }
+
+        const size_t base = static_cast<size_t>(offset - pendingStart);
+        for (size_t t = 0; t < numTracks; ++t) {
+            size_t count = std::min(pending[t].size() - std::min(base, pending[t].size()),
+                                    static_cast<size_t>(fftSize));
+            // 不超过一个窗长的输入恰好产生一帧，越界部分补零
+            const double* samples = pending[t].data() + std::min(base, pending[t].size());
+            std::vector<double> bins = std::move(analyzer.compute(samples, count, hopSize)[0]);
+
+            const auto& rows = panelRows[t];
+            for (size_t y = 0; y < rows.size(); ++y) {
+                double intensity = 0.0;
+                if (rows[y].band >= 0) {
+                    intensity = *std::max_element(bins.begin() + rows[y].lo, bins.begin() + rows[y].hi + 1);
+                }
+                column[panelTop[t] + y] = static_cast<unsigned char>(std::lround(intensity * 255));
+            }
+        }
+
+        // 之后的帧不会再写入当前帧第一列之前的列，前面写满的列块写入临时文件
+        for (size_t x = firstColumn(frame), last = lastColumn(frame); x <= last; ++x) {
+            if (spill && x >= (tileIndex + 1) * tileColumns && !flushTile()) return false;
+            const size_t tileWidth = std::min(tileColumns, columns - tileIndex * tileColumns);
+            unsigned char* out = &tile[x - tileIndex * tileColumns];
+            for (int y = 0; y < height; ++y) {
+                out[y * tileWidth] = x >= nextColumn ? column[y] : std::max(out[y * tileWidth], column[y]);
+            }
+        }
+        nextColumn = lastColumn(frame) + 1;
+        ++frame;
+
+        // 丢弃之后的帧不再需要的采样
+        const sf_count_t keepFrom = std::min<sf_count_t>(static_cast<sf_count_t>(frame) * hopSize, received);
+        if (keepFrom - pendingStart >= kChunkFrames) {
+            size_t drop = static_cast<size_t>(keepFrom - pendingStart);
+            for (auto& samples : pending) {
+                samples.erase(samples.begin(), samples.begin() + std::min(drop, samples.size()));
+            }
+            pendingStart = keepFrom;
+        }
+    }
+    pending = std::vector<std::vector<double>>();
+    if (spill && !flushTile()) return false;
+
+    // 编码：按行读回各列块，着色后逐行写入 PNG
+    unsigned char palette[256][3];
+    for (int q = 0; q < 256; ++q) {
+        Spectrogram::intensityColor(q / 255.0, palette[q]);
+    }
+    std::vector<bool> separator(height, false);
+    for (size_t t = 1; t < numTracks; ++t) {
+        separator[panelTop[t]] = true;
+    }
+
+    PngStreamWriter png;
+    if (!png.open(outputFile, width, height, error)) {
+        return false;
+    }
+    // 与 Spectrogram 的图像相同的音符刻度和标签，叠加层的大小与图像宽度无关
+    auto overlay = NoteOverlay::get(width, height, static_cast<int>(numTracks),
+                                    specConfig.min_freq, specConfig.max_freq);
+    std::vector<unsigned char> rgb(kSegmentColumns * 3);
+    // 着色第 y 行中从第 x 列开始的 count 个像素并写入
+    auto emit = [&](size_t y, size_t x, const unsigned char* intensities, size_t count) {
+        bool ok = true;
+        for (size_t done = 0; done < count && ok; done += kSegmentColumns) {
+            size_t n = std::min(kSegmentColumns, count - done);
+            if (separator[y]) {
+                memset(rgb.data(), 128, n * 3);
+            } else {
+                for (size_t i = 0; i < n; ++i) {
+                    memcpy(&rgb[i * 3], palette[intensities[done + i]], 3);
+                }
+            }
+            overlay->blendRow(static_cast<int>(y), x + done, rgb.data(), n);
+            ok = png.write(rgb.data(), n * 3);
+        }
+        return ok;
+    };
+
+    if (!spill) {
+        for (int y = 0; y < height; ++y) {
+            if (!emit(y, 0, &tile[static_cast<size_t>(y) * columns], columns)) break;
+        }
+        return png.finish(error);
+    }
+
+    // 列块在临时文件中依次存放，块内按行存放；条带行数由预算决定，宽度超出预算时逐块读取每一行
+    const size_t numTiles = (columns + tileColumns - 1) / tileColumns;
+    const size_t stripeRows = std::min<size_t>(height, available / columns);
+    const size_t bufferColumns = stripeRows > 0 ? columns : tileColumns;
+    tile = std::vector<unsigned char>();
+    std::vector<unsigned char> stripe(std::max<size_t>(1, stripeRows) * bufferColumns);
+
+    auto readSegment = [&](size_t k, size_t y, size_t rows, unsigned char* out, size_t outStride) {
+        const size_t tileWidth = std::min(tileColumns, columns - k * tileColumns);
+        off_t position = static_cast<off_t>(k * tileColumns) * height + static_cast<off_t>(y * tileWidth);
+        if (fseeko(spillFile.file, position, SEEK_SET) != 0) return false;
+        for (size_t r = 0; r < rows; ++r) {
+            if (fread(out + r * outStride, 1, tileWidth, spillFile.file) != tileWidth) return false;
+        }
+        return true;
+    };
+
+    bool ok = true;
+    if (stripeRows > 0) {
+        for (size_t y0 = 0; y0 < static_cast<size_t>(height) && ok; y0 += stripeRows) {
+            size_t rows = std::min(stripeRows, height - y0);
+            for (size_t k = 0; k < numTiles && ok; ++k) {
+                ok = readSegment(k, y0, rows, &stripe[k * tileColumns], columns);
+            }
+            for (size_t r = 0; r < rows && ok; ++r) {
+                ok = emit(y0 + r, 0, &stripe[r * columns], columns);
+            }
+        }
+    } else {
+        for (size_t y = 0; y < static_cast<size_t>(height) && ok; ++y) {
+            for (size_t k = 0; k < numTiles && ok; ++k) {
+                const size_t tileWidth = std::min(tileColumns, columns - k * tileColumns);
+                ok = readSegment(k, y, 1, stripe.data(), tileWidth) &&
+                     emit(y, k * tileColumns, stripe.data(), tileWidth);
+            }
+        }
+    }
+    if (!ok) {
+        std::string ignored;
+        png.finish(ignored);
+        error = "读取临时文件或写入 PNG 失败";
+        return false;
+    }
+    return png.finish(error);
+}
@@ -1,6 +1,44 @@
 #include <gtest/gtest.h>
 #include "spectrogram.hpp"
 #include "note_utils.hpp"
+#include "analyzer.hpp"
+#include "pipeline.hpp"
+#include "options.hpp"
+#include "server.hpp"
+#include "audio_processor.hpp"
+#include "msa.h"
+#include "lazy_analyzer.hpp"
+#include "stream_renderer.hpp"
+#include "fingerprint.hpp"
+#include "narrowband.hpp"
+#include "note_overlay.hpp"
+#include <filesystem>
+#include <random>
+#include <fstream>
+#include <iterator>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <sndfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+
+// 将交错排列的样本写成 32 位浮点 WAV 文件
+static bool writeTestWav(const std::string& path, const std::vector<double>& frames, int channels, int sampleRate) {
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    info.samplerate = sampleRate;
+    info.channels = channels;
+    info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+    SNDFILE* file = sf_open(path.c_str(), SFM_WRITE, &info);
+    if (!file) return false;
+    sf_count_t count = frames.size() / channels;
+    bool written = sf_writef_double(file, frames.data(), count) == count;
+    return sf_close(file) == 0 && written;
+}
 
 // 测试音符到频率的转换
 TEST(SpectrogramTest, NoteToFreqConversion) {
@@ -38,6 +76,744 @@ TEST(SpectrogramTest, BasicGeneration) {
     EXPECT_GT(config.max_freq, config.min_freq);
 }
 
+// 测试有界队列的背压与关闭语义
+TEST(PipelineTest, BoundedQueueDrainsAfterClose) {
+    BoundedQueue<int> queue(2);
+    std::thread producer([&] {
+        for (int i = 0; i < 10; ++i) {
+            ASSERT_TRUE(queue.push(i));
+        }
+        queue.close();
+    });
+
+    int value = 0;
+    int expected = 0;
+    while (queue.pop(value)) {
+        EXPECT_EQ(value, expected++);
+    }
+    producer.join();
+
+    EXPECT_EQ(expected, 10);
+    EXPECT_FALSE(queue.push(42));
+
+    BoundedQueue<int> full(1);
+    EXPECT_TRUE(full.tryPush(1));
+    EXPECT_FALSE(full.tryPush(2));
+}
+
+// 测试流水线只在 PNG 写入成功时计为成功
+TEST(PipelineTest, CountsOnlyWrittenImages) {
+    const int sampleRate = 8000;
+    const std::string inputFile = testing::TempDir() + "spectrum_pipeline_tone.wav";
+    std::vector<double> samples(sampleRate);
+    for (int i = 0; i < sampleRate; ++i) samples[i] = 0.5 * std::sin(2 * M_PI * 440.0 * i / sampleRate);
+    ASSERT_TRUE(writeTestWav(inputFile, samples, 1, sampleRate));
+
+    Spectrogram::Config spec;
+    spec.width = 100;
+    spec.height = 80;
+    spec.max_freq = 3000.0;
+    Pipeline pipeline(Pipeline::Config(), spec);
+    const std::string outputFile = testing::TempDir() + "spectrum_pipeline_tone.png";
+    const std::string unwritable = testing::TempDir() + "spectrum_missing_dir/tone.png";
+    EXPECT_EQ(pipeline.run({{inputFile, outputFile}, {inputFile, unwritable}}), 1u);
+    EXPECT_TRUE(std::filesystem::exists(outputFile));
+    EXPECT_FALSE(std::filesystem::exists(unwritable));
+}
+
+// 测试分析器对正弦波的峰值位置
+TEST(AnalyzerTest, SinePeakBin) {
+    const int sampleRate = 44100;
+    const int fftSize = 2048;
+    std::vector<double> samples(sampleRate);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = std::sin(2 * M_PI * 440.0 * i / sampleRate);
+    }
+
+    StftAnalyzer analyzer(fftSize);
+    auto specData = analyzer.compute(samples, 441);
+    ASSERT_EQ(specData.size(), (samples.size() - fftSize) / 441 + 1);
+
+    const auto& frame = specData[specData.size() / 2];
+    size_t peak = std::max_element(frame.begin(), frame.end()) - frame.begin();
+    EXPECT_EQ(peak, static_cast<size_t>(std::round(440.0 * fftSize / sampleRate)));
+    EXPECT_NEAR(frame[peak], 1.0, 0.05);
+}
+
+// 测试多分辨率频段划分与频段计算
+TEST(AnalyzerTest, MultiResolutionBands) {
+    const int sampleRate = 44100;
+    auto plans = planBands({512, 8192, 2048}, sampleRate, 441, 2048, 20.0, 20000.0);
+    ASSERT_EQ(plans.size(), 3u);
+
+    // 长窗负责低频并使用更大的帧间隔，频段首尾相接
+    EXPECT_EQ(plans[0].fft_size, 8192);
+    EXPECT_EQ(plans[0].hop_size, 441 * 4);
+    EXPECT_EQ(plans[2].fft_size, 512);
+    EXPECT_EQ(plans[2].hop_size, 441);
+    EXPECT_DOUBLE_EQ(plans[0].min_freq, 20.0);
+    EXPECT_DOUBLE_EQ(plans[0].max_freq, plans[1].min_freq);
+    EXPECT_DOUBLE_EQ(plans[1].max_freq, plans[2].min_freq);
+    EXPECT_GE(plans[2].max_freq, 20000.0);
+
+    // 频段只保存自己负责的 bin
+    std::vector<double> samples(sampleRate);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = std::sin(2 * M_PI * 110.0 * i / sampleRate);
+    }
+    StftAnalyzer analyzer(plans[0].fft_size);
+    auto band = analyzer.computeBand(samples, sampleRate, plans[0].hop_size,
+                                     plans[0].min_freq, plans[0].max_freq);
+    EXPECT_EQ(band.frames.size(), (samples.size() + band.hop_size - 1) / band.hop_size);
+    EXPECT_LT(band.frames[0].size(), static_cast<size_t>(8192 / 2 + 1));
+
+    const auto& frame = band.frames[band.frames.size() / 2];
+    size_t peak = std::max_element(frame.begin(), frame.end()) - frame.begin() + band.first_bin;
+    EXPECT_EQ(peak, static_cast<size_t>(std::round(110.0 * 8192 / sampleRate)));
+}
+
+// 测试命令行与服务请求共用的选项解析
+TEST(OptionsTest, ParseOptions) {
+    Options options;
+    std::string error;
+    ASSERT_TRUE(parseOptions({"-l", "A3", "-u", "880", "-b", "1.5", "-e", "4", "--multi-res", "4096,1024"},
+                             options, error));
+    EXPECT_NEAR(options.spec.min_freq, 220.0, 0.01);
+    EXPECT_NEAR(options.spec.max_freq, 880.0, 0.01);
+    EXPECT_NEAR(options.spec.duration, 2.5, 1e-9);
+    EXPECT_EQ(options.pipeline.resolution_ffts, (std::vector<int>{4096, 1024}));
+
+    Options invalid;
+    EXPECT_FALSE(parseOptions({"-b", "1", "-e", "2", "-d", "3"}, invalid, error));
+    EXPECT_FALSE(parseOptions({"-s"}, invalid, error));
+    EXPECT_FALSE(parseOptions({"--unknown", "1"}, invalid, error));
+    EXPECT_FALSE(parseOptions({"--max-memory", "64", "--multi-res", "4096,1024"}, invalid, error));
+
+    // 显式指定的宽度也用于流式渲染
+    Options streaming;
+    ASSERT_TRUE(parseOptions({"--max-memory", "64", "--size", "800x600"}, streaming, error)) << error;
+    EXPECT_TRUE(streaming.pipeline.stream_fit_width);
+
+    EXPECT_EQ(outputFileFor("/data/take.flac", "out"), "out/take.png");
+}
+
+// 测试服务的分帧协议：同一请求分别以路径和 PNG 数据返回
+TEST(ServerTest, PathAndBytesRoundTrip) {
+    const int sampleRate = 8000;
+    const std::string inputFile = testing::TempDir() + "spectrum_server_tone.wav";
+    std::vector<double> samples(sampleRate);
+    for (int i = 0; i < sampleRate; ++i) samples[i] = 0.5 * std::sin(2 * M_PI * 440.0 * i / sampleRate);
+    ASSERT_TRUE(writeTestWav(inputFile, samples, 1, sampleRate));
+
+    // 套接字路径上已有普通文件时拒绝启动，且不删除该文件
+    const std::string socketPath = testing::TempDir() + "spectrum_test.sock";
+    std::filesystem::remove(socketPath);
+    std::ofstream(socketPath) << "keep";
+    SpectrumServer::Config serverConfig;
+    serverConfig.socket_path = socketPath;
+    serverConfig.workers = 1;
+    std::string error;
+    EXPECT_FALSE(SpectrumServer(serverConfig).run(error));
+    EXPECT_TRUE(std::filesystem::is_regular_file(socketPath));
+    std::filesystem::remove(socketPath);
+
+    // 上次运行残留的套接字文件（无人监听）被清理
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(bind(stale, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+    close(stale);
+
+    bool started = false;
+    std::thread serverThread([&] {
+        std::string serverError;
+        started = SpectrumServer(serverConfig).run(serverError);
+    });
+
+    const std::string outputDir = testing::TempDir() + "spectrum_server_out";
+    const std::vector<std::string> options = {"--size", "120x80", "-u", "3000"};
+    std::string result;
+    bool connected = false;
+    for (int attempt = 0; attempt < 100 && !connected; ++attempt) {
+        connected = sendServerRequest(socketPath, false, inputFile, outputDir, options, result, error);
+        if (!connected) std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    ASSERT_TRUE(connected) << error;
+    EXPECT_EQ(result, outputFileFor(inputFile, outputDir));
+    EXPECT_TRUE(std::filesystem::exists(result));
+
+    const std::string pngSignature("\x89PNG\r\n\x1a\n", 8);
+    ASSERT_TRUE(sendServerRequest(socketPath, true, inputFile, outputDir, options, result, error)) << error;
+    EXPECT_EQ(result.compare(0, 8, pngSignature), 0);
+
+    // 已有服务在监听时拒绝启动，不删除其套接字
+    EXPECT_FALSE(SpectrumServer(serverConfig).run(error));
+    EXPECT_TRUE(std::filesystem::exists(socketPath));
+
+    // 空闲的连接不占用唯一的工作线程
+    int idle = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(idle, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+    ASSERT_TRUE(sendServerRequest(socketPath, false, inputFile, outputDir, options, result, error)) << error;
+    close(idle);
+
+    // 批处理专用的选项被拒绝
+    EXPECT_FALSE(sendServerRequest(socketPath, false, inputFile, outputDir, {"--index", outputDir}, result, error));
+    EXPECT_NE(error.find("--index"), std::string::npos);
+
+    // 失败的请求返回错误状态和信息
+    EXPECT_FALSE(sendServerRequest(socketPath, true, inputFile + ".missing", outputDir, options, result, error));
+    EXPECT_FALSE(error.empty());
+
+    SpectrumServer::stop();
+    serverThread.join();
+    EXPECT_TRUE(started);
+    EXPECT_FALSE(std::filesystem::exists(socketPath));
+}
+
+// 测试一次解码拆分左/右/中/侧，并发分析与逐路分析结果一致
+TEST(AnalyzerTest, MidSideDecodeAndConcurrentAnalysis) {
+    const int sampleRate = 8000;
+    const std::string path = testing::TempDir() + "spectrum_stereo_test.wav";
+
+    std::vector<double> frames(sampleRate * 2);
+    for (int i = 0; i < sampleRate; ++i) {
+        frames[i * 2] = 0.5 * std::sin(2 * M_PI * 440.0 * i / sampleRate);
+        frames[i * 2 + 1] = 0.25 * std::sin(2 * M_PI * 1000.0 * i / sampleRate);
+    }
+    ASSERT_TRUE(writeTestWav(path, frames, 2, sampleRate));
+
+    Spectrogram::Config config;
+    AudioClip clip;
+    std::string error;
+    ASSERT_TRUE(decodeAudioFile(path, config, ChannelMode::MidSide, clip, error)) << error;
+    std::remove(path.c_str());
+
+    ASSERT_EQ(clip.tracks.size(), 4u);
+    EXPECT_EQ(clip.trackNames, (std::vector<std::string>{"L", "R", "M", "S"}));
+    for (int i = 0; i < sampleRate; ++i) {
+        EXPECT_NEAR(clip.tracks[2][i], (frames[i * 2] + frames[i * 2 + 1]) / 2, 1e-6);
+        EXPECT_NEAR(clip.tracks[3][i], (frames[i * 2] - frames[i * 2 + 1]) / 2, 1e-6);
+    }
+
+    AnalyzerCache sequential;
+    AnalyzerCache concurrent;
+    auto expected = sequential.analyze(clip, config, 1024, {}, 1);
+    auto actual = concurrent.analyze(clip, config, 1024, {}, 4);
+    ASSERT_EQ(actual.size(), 4u);
+    for (size_t t = 0; t < actual.size(); ++t) {
+        EXPECT_EQ(actual[t][0].frames, expected[t][0].frames);
+    }
+}
+
+// 测试进程内接口：调用者的 PCM 直接分析，结果写入调用者的内存
+TEST(LibraryTest, AnalyzeCallerPcm) {
+    const int sampleRate = 8000;
+    std::vector<double> samples(sampleRate);
+    for (int i = 0; i < sampleRate; ++i) {
+        samples[i] = std::sin(2 * M_PI * 1000.0 * i / sampleRate);
+    }
+
+    AudioProcessor::Options options;
+    options.fft_size = 512;
+    options.spec.min_freq = 100;
+    options.spec.max_freq = 4000;
+    AudioProcessor processor(options);
+    std::string error;
+    ASSERT_TRUE(processor.analyzeSamples(samples.data(), samples.size(), 1, sampleRate, error)) << error;
+
+    const auto& tracks = processor.getTracks();
+    ASSERT_EQ(tracks.size(), 1u);
+    const auto& frame = tracks[0][0].frames[5];
+    EXPECT_EQ(std::max_element(frame.begin(), frame.end()) - frame.begin(), 64);  // 1000 Hz / (8000/512)
+
+    // 渲染到带行填充的调用者缓冲区，填充字节保持不变
+    const int width = 50, height = 40;
+    const size_t stride = width * 3 + 5;
+    std::vector<unsigned char> pixels(stride * height, 7);
+    ASSERT_TRUE(processor.render(pixels.data(), width, height, stride, error)) << error;
+    EXPECT_EQ(pixels[stride - 1], 7);
+    EXPECT_EQ(*std::max_element(pixels.begin(), pixels.end()), 255);
+
+    // C 接口：先查询大小，再复制到调用者的内存
+    msa_options cOptions;
+    msa_default_options(&cOptions);
+    cOptions.fft_size = 512;
+    msa_processor* handle = msa_create(&cOptions);
+    ASSERT_NE(handle, nullptr);
+    std::vector<float> floats(samples.begin(), samples.end());
+    ASSERT_EQ(msa_analyze_pcm_f32(handle, floats.data(), floats.size(), 1, sampleRate), 1);
+    msa_band_info info;
+    ASSERT_EQ(msa_band_info_get(handle, 0, 0, &info), 1);
+    size_t needed = msa_copy_band(handle, 0, 0, nullptr, 0);
+    EXPECT_EQ(needed, info.num_frames * info.num_bins);
+    std::vector<double> matrix(needed);
+    EXPECT_EQ(msa_copy_band(handle, 0, 0, matrix.data(), matrix.size()), needed);
+    EXPECT_NEAR(matrix[5 * info.num_bins + 64], 1.0, 0.05);
+    EXPECT_EQ(msa_analyze_pcm_f64(handle, samples.data(), samples.size(), 0, sampleRate), 0);
+    EXPECT_STRNE(msa_last_error(handle), "");
+    // 成功的调用清除上一次的错误
+    EXPECT_EQ(msa_band_info_get(handle, 0, 0, &info), 1);
+    EXPECT_STREQ(msa_last_error(handle), "");
+    EXPECT_EQ(msa_copy_band(handle, 0, 99, nullptr, 0), 0u);
+    EXPECT_STRNE(msa_last_error(handle), "");
+    msa_destroy(handle);
+
+    // 无效的多分辨率选项与命令行一样被拒绝
+    const int badSizes[] = {1024, 0};
+    cOptions.resolution_ffts = badSizes;
+    cOptions.num_resolution_ffts = 2;
+    EXPECT_EQ(msa_create(&cOptions), nullptr);
+    cOptions.num_resolution_ffts = -1;
+    EXPECT_EQ(msa_create(&cOptions), nullptr);
+    cOptions.resolution_ffts = nullptr;
+    cOptions.num_resolution_ffts = 1;
+    EXPECT_EQ(msa_create(&cOptions), nullptr);
+}
+
+// 测试预览只计算需要的帧，补齐后与完整分析的结果一致
+TEST(LazyAnalyzerTest, PreviewThenRefine) {
+    const int sampleRate = 8000;
+    const int seconds = 20;
+    const std::string path = testing::TempDir() + "spectrum_lazy_test.wav";
+
+    std::vector<double> samples(sampleRate * seconds);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        double freq = 200.0 + 50.0 * i / sampleRate;  // 随时间上升的音高
+        samples[i] = 0.5 * std::sin(2 * M_PI * freq * i / sampleRate);
+    }
+    ASSERT_TRUE(writeTestWav(path, samples, 1, sampleRate));
+
+    Spectrogram::Config config;
+    config.samples_per_sec = 100;
+    LazyAnalyzer lazy;
+    std::string error;
+    ASSERT_TRUE(lazy.open(path, config, ChannelMode::Mono, 512, error)) << error;
+
+    std::vector<Spectrogram::Track> preview;
+    Spectrogram::Config previewConfig;
+    ASSERT_TRUE(lazy.preview(100, preview, previewConfig, error)) << error;
+    const size_t step = (lazy.frameCount() + 99) / 100;
+    EXPECT_EQ(lazy.computedCount(), preview[0][0].frames.size());
+    EXPECT_EQ(previewConfig.width, static_cast<int>(preview[0][0].frames.size()));
+    EXPECT_LE(previewConfig.width, 100);
+    // 预览阶段不为未计算的帧分配空间
+    EXPECT_TRUE(lazy.getTracks()[0][0].frames.empty());
+
+    ASSERT_TRUE(lazy.refine(error)) << error;
+    EXPECT_EQ(lazy.computedCount(), lazy.frameCount());
+
+    AudioClip clip;
+    ASSERT_TRUE(decodeAudioFile(path, config, ChannelMode::Mono, clip, error)) << error;
+    std::remove(path.c_str());
+    AnalyzerCache analyzers;
+    auto expected = analyzers.analyze(clip, config, 512, {});
+    const auto& frames = lazy.getTracks()[0][0].frames;
+    EXPECT_EQ(frames, expected[0][0].frames);
+    for (size_t c = 0; c < preview[0][0].frames.size(); ++c) {
+        EXPECT_EQ(preview[0][0].frames[c], frames[c * step]);
+    }
+}
+
+// 测试流式渲染：写入临时文件与完全在内存中渲染的结果相同
+TEST(StreamingRendererTest, SpillMatchesInMemory) {
+    const int sampleRate = 8000;
+    const std::string input = testing::TempDir() + "spectrum_stream_test.wav";
+
+    std::vector<double> frames(sampleRate * 20 * 2);
+    for (size_t i = 0; i < frames.size() / 2; ++i) {
+        frames[i * 2] = 0.5 * std::sin(2 * M_PI * 440.0 * i / sampleRate);
+        frames[i * 2 + 1] = 0.5 * std::sin(2 * M_PI * 1000.0 * i / sampleRate);
+    }
+    ASSERT_TRUE(writeTestWav(input, frames, 2, sampleRate));
+
+    Spectrogram::Config spec;
+    spec.min_freq = 100;
+    spec.max_freq = 4000;
+    StreamingRenderer::Config config;
+    config.fft_size = 512;
+    config.channel_mode = ChannelMode::Channels;
+
+    auto readFile = [](const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    };
+
+    std::string error;
+    const std::string inMemory = testing::TempDir() + "spectrum_stream_memory.png";
+    config.max_memory = size_t(256) << 20;
+    StreamingRenderer large(config, spec);
+    ASSERT_TRUE(large.render(input, inMemory, error)) << error;
+    EXPECT_EQ(large.getSpilledBytes(), 0u);
+    EXPECT_EQ(large.getWidth(), (sampleRate * 20 - 512) / 80 + 1);
+
+    const std::string spilled = testing::TempDir() + "spectrum_stream_spill.png";
+    config.max_memory = size_t(8) << 20;
+    StreamingRenderer small(config, spec);
+    ASSERT_TRUE(small.render(input, spilled, error)) << error;
+    EXPECT_EQ(small.getSpilledBytes(), static_cast<uint64_t>(small.getWidth()) * spec.height);
+
+    std::vector<char> a = readFile(inMemory);
+    std::vector<char> b = readFile(spilled);
+    ASSERT_GT(a.size(), 33u);
+    EXPECT_EQ(a, b);
+    // IHDR 中的宽度为帧数
+    EXPECT_EQ((static_cast<unsigned char>(a[18]) << 8) | static_cast<unsigned char>(a[19]), large.getWidth());
+
+    // 指定宽度时各帧归入对应的列，少于或多于帧数都与不写临时文件的结果相同
+    for (int width : {700, 3000}) {
+        config.width = width;
+        config.max_memory = size_t(256) << 20;
+        StreamingRenderer fitted(config, spec);
+        ASSERT_TRUE(fitted.render(input, inMemory, error)) << error;
+        EXPECT_EQ(fitted.getWidth(), width);
+        config.max_memory = size_t(8) << 20;
+        StreamingRenderer fittedSmall(config, spec);
+        ASSERT_TRUE(fittedSmall.render(input, spilled, error)) << error;
+        if (width > large.getWidth()) {
+            EXPECT_GT(fittedSmall.getSpilledBytes(), 0u);
+        }
+        a = readFile(inMemory);
+        EXPECT_EQ(a, readFile(spilled));
+        EXPECT_EQ((static_cast<unsigned char>(a[18]) << 8) | static_cast<unsigned char>(a[19]), width);
+    }
+    config.width = 0;
+
+    config.max_memory = 1 << 20;
+    EXPECT_FALSE(StreamingRenderer(config, spec).render(input, spilled, error));
+
+    std::remove(input.c_str());
+    std::remove(inMemory.c_str());
+    std::remove(spilled.c_str());
+}
+
+TEST(FingerprintTest, FindsTrimmedCopyAfterReopen) {
+    const int sampleRate = 16000;
+
+    // 随机音符序列，每个音符 0.25 秒
+    auto melody = [&](unsigned seed) {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<double> pitch(200.0, 3000.0);
+        std::vector<double> samples;
+        for (int note = 0; note < 60; ++note) {
+            double freq = pitch(random);
+            for (int i = 0; i < sampleRate / 4; ++i) {
+                samples.push_back(0.3 * std::sin(2 * M_PI * freq * i / sampleRate) +
+                                  0.2 * std::sin(2 * M_PI * freq * 1.5 * i / sampleRate));
+            }
+        }
+        return samples;
+    };
+    AnalyzerCache analyzers;
+    Spectrogram::Config spec;
+    auto fingerprint = [&](const std::vector<double>& samples) {
+        return computeFingerprint(analyzers.analyze(samples, sampleRate, spec, 2048, {}), sampleRate);
+    };
+
+    // 截取 2.5 秒之后的 8 秒并降低音量
+    std::vector<double> original = melody(1);
+    std::vector<double> trimmed(original.begin() + sampleRate * 5 / 2 + 123,
+                                original.begin() + sampleRate * 21 / 2);
+    for (double& sample : trimmed) sample *= 0.5;
+    std::vector<double> unrelated = melody(2);
+
+    const std::string directory = testing::TempDir() + "spectrum_fingerprint_index";
+    std::filesystem::remove_all(directory);
+    const std::string originalFile = testing::TempDir() + "spectrum_fp_original.wav";
+    const std::string unrelatedFile = testing::TempDir() + "spectrum_fp_unrelated.wav";
+    ASSERT_TRUE(writeTestWav(originalFile, original, 1, sampleRate));
+    ASSERT_TRUE(writeTestWav(unrelatedFile, unrelated, 1, sampleRate));
+
+    std::string error;
+    {
+        FingerprintIndex index;
+        ASSERT_TRUE(index.open(directory, error)) << error;
+        ASSERT_TRUE(index.add(originalFile, "original.png", "options", fingerprint(original), 15.0, error)) << error;
+        ASSERT_TRUE(index.add(unrelatedFile, "unrelated.png", "options", fingerprint(unrelated), 15.0, error)) << error;
+    }
+
+    // 重新打开后仍能查到，且不需要重新解码已索引的文件
+    FingerprintIndex index;
+    ASSERT_TRUE(index.open(directory, error)) << error;
+    EXPECT_EQ(index.size(), 2u);
+    const FingerprintIndex::Entry* entry = index.find(originalFile);
+    ASSERT_NE(entry, nullptr);
+    EXPECT_TRUE(index.unchanged(*entry));
+    std::vector<FingerprintHash> stored;
+    ASSERT_TRUE(index.loadFingerprint(*entry, stored, error)) << error;
+    EXPECT_EQ(stored.size(), fingerprint(original).size());
+
+    auto matches = index.query(fingerprint(trimmed), 2);
+    ASSERT_EQ(matches.size(), 2u);
+    EXPECT_EQ(matches[0].entry->input_file, entry->input_file);
+    EXPECT_DOUBLE_EQ(matches[0].entry->duration, 15.0);
+    // 片段的哈希大多能在原录音中找到，但只占原录音的一部分
+    EXPECT_GT(matches[0].coverage, 0.3);
+    EXPECT_LT(matches[0].similarity, matches[0].coverage * 0.7);
+    EXPECT_NEAR(matches[0].offset, 2.5, 0.05);
+    EXPECT_LT(matches[1].similarity, 0.1);
+
+    // 排除自身后，与其他录音都不相似
+    matches = index.query(stored, 1, entry->id);
+    ASSERT_EQ(matches.size(), 1u);
+    EXPECT_LT(matches[0].similarity, 0.1);
+}
+
+// 测试索引只在渲染选项相同时跳过文件或链接重复的录音
+TEST(FingerprintTest, ReusesImagesOnlyWithSameOptions) {
+    const int sampleRate = 16000;
+    std::mt19937 random(3);
+    std::uniform_real_distribution<double> pitch(200.0, 3000.0);
+    std::vector<double> samples;
+    for (int note = 0; note < 40; ++note) {
+        double freq = pitch(random);
+        for (int i = 0; i < sampleRate / 4; ++i) {
+            samples.push_back(0.3 * std::sin(2 * M_PI * freq * i / sampleRate));
+        }
+    }
+    const std::string directory = testing::TempDir() + "spectrum_options_index";
+    const std::string outputDir = testing::TempDir() + "spectrum_options_out";
+    std::filesystem::remove_all(directory);
+    std::filesystem::remove_all(outputDir);
+    std::filesystem::create_directories(outputDir);
+    const std::string original = testing::TempDir() + "spectrum_options_a.wav";
+    const std::string copy = testing::TempDir() + "spectrum_options_b.wav";
+    ASSERT_TRUE(writeTestWav(original, samples, 1, sampleRate));
+    std::filesystem::copy_file(original, copy, std::filesystem::copy_options::overwrite_existing);
+
+    // PNG 文件头 IHDR 中的宽度
+    auto imageWidth = [](const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        unsigned char header[24] = {};
+        in.read(reinterpret_cast<char*>(header), sizeof(header));
+        return (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+    };
+
+    Pipeline::Config config;
+    config.index_dir = directory;
+    Spectrogram::Config spec;
+    spec.width = 100;
+    spec.height = 80;
+    const std::string originalPng = outputFileFor(original, outputDir);
+    const std::string copyPng = outputFileFor(copy, outputDir);
+    EXPECT_EQ(Pipeline(config, spec).run({{original, originalPng}}), 1u);
+    EXPECT_EQ(imageWidth(originalPng), 100);
+
+    // 同样的选项下，重复的录音链接到已有的图像
+    EXPECT_EQ(Pipeline(config, spec).run({{copy, copyPng}}), 1u);
+    EXPECT_TRUE(std::filesystem::is_symlink(copyPng));
+
+    // 从头截取的片段与完整录音起点相同，但首尾不吻合，照常渲染
+    const std::string trimmed = testing::TempDir() + "spectrum_options_trimmed.wav";
+    ASSERT_TRUE(writeTestWav(trimmed, std::vector<double>(samples.begin(), samples.begin() + samples.size() * 4 / 5),
+                             1, sampleRate));
+    const std::string trimmedPng = outputFileFor(trimmed, outputDir);
+    EXPECT_EQ(Pipeline(config, spec).run({{trimmed, trimmedPng}}), 1u);
+    EXPECT_FALSE(std::filesystem::is_symlink(trimmedPng));
+    EXPECT_EQ(imageWidth(trimmedPng), 100);
+
+    // 按声道分析时指纹取自混音：左声道静音、右声道为原录音，仍能找到原录音
+    const std::string stereo = testing::TempDir() + "spectrum_options_stereo.wav";
+    std::vector<double> frames(samples.size() * 2, 0.0);
+    for (size_t i = 0; i < samples.size(); ++i) frames[i * 2 + 1] = samples[i];
+    ASSERT_TRUE(writeTestWav(stereo, frames, 2, sampleRate));
+    Pipeline::Config channels = config;
+    channels.channel_mode = ChannelMode::Channels;
+    EXPECT_EQ(Pipeline(channels, spec).run({{stereo, outputFileFor(stereo, outputDir)}}), 1u);
+    {
+        FingerprintIndex index;
+        std::string error;
+        ASSERT_TRUE(index.open(directory, error)) << error;
+        const FingerprintIndex::Entry* entry = index.find(stereo);
+        ASSERT_NE(entry, nullptr);
+        std::vector<FingerprintHash> hashes;
+        ASSERT_TRUE(index.loadFingerprint(*entry, hashes, error)) << error;
+        auto matches = index.query(hashes, 1, entry->id);
+        ASSERT_EQ(matches.size(), 1u);
+        EXPECT_GT(matches[0].similarity, 0.5);
+        EXPECT_NEAR(matches[0].entry->duration, samples.size() / double(sampleRate), 0.01);
+    }
+    std::remove(trimmed.c_str());
+    std::remove(stereo.c_str());
+
+    // 选项改变后两个文件都重新渲染
+    spec.width = 120;
+    std::filesystem::remove(copyPng);
+    EXPECT_EQ(Pipeline(config, spec).run({{original, originalPng}}), 1u);
+    EXPECT_EQ(imageWidth(originalPng), 120);
+    spec.width = 140;
+    EXPECT_EQ(Pipeline(config, spec).run({{copy, copyPng}}), 1u);
+    EXPECT_FALSE(std::filesystem::is_symlink(copyPng));
+    EXPECT_EQ(imageWidth(copyPng), 140);
+}
+
+// 测试索引段按大小分级合并，中断留下的段和未写入清单的文件在重新打开时得到修复
+TEST(FingerprintTest, SegmentsSurviveInterruptedWrites) {
+    const std::string directory = testing::TempDir() + "spectrum_segment_index";
+    const std::string input = testing::TempDir() + "spectrum_segment_input";
+    std::filesystem::remove_all(directory);
+    std::filesystem::remove_all(input);
+    std::filesystem::create_directories(input);
+    for (int i = 0; i <= 40; ++i) std::ofstream(input + "/" + std::to_string(i)) << "audio";
+    const std::filesystem::path segmentDir = std::filesystem::path(directory) / "segments";
+    auto segmentCount = [&] {
+        return std::distance(std::filesystem::directory_iterator(segmentDir), std::filesystem::directory_iterator()) - 1;
+    };
+
+    std::mt19937 random(4);
+    auto randomPrint = [&] {
+        std::vector<FingerprintHash> hashes(200);
+        for (size_t i = 0; i < hashes.size(); ++i) {
+            // 哈希低 7 位是两峰的时间差，取 1 到 100
+            uint32_t hash = (static_cast<uint32_t>(random()) & 0xFFFF80) | static_cast<uint32_t>(1 + random() % 100);
+            hashes[i] = {hash, static_cast<uint32_t>(i * 7)};
+        }
+        return hashes;
+    };
+
+    std::string error;
+    std::vector<std::vector<FingerprintHash>> prints;
+    {
+        FingerprintIndex index;
+        ASSERT_TRUE(index.open(directory, error)) << error;
+        for (int i = 0; i < 40; ++i) {
+            prints.push_back(randomPrint());
+            ASSERT_TRUE(index.add(input + "/" + std::to_string(i), "out.png", "options", prints.back(), 1.0, error)) << error;
+        }
+        // 40 个同样大小的段合并后只剩少数几个
+        EXPECT_LE(segmentCount(), 6);
+        EXPECT_FALSE(index.add(input + "/\tbad", "out.png", "options", prints[0], 1.0, error));
+    }
+
+    // 模拟最后一次添加在登记文件之后、写入清单之前中断，并留下一个未完成合并的段
+    const std::filesystem::path manifest = segmentDir / "MANIFEST";
+    const std::string saved = directory + "_manifest";
+    std::filesystem::copy_file(manifest, saved, std::filesystem::copy_options::overwrite_existing);
+    {
+        FingerprintIndex index;
+        ASSERT_TRUE(index.open(directory, error)) << error;
+        prints.push_back(randomPrint());
+        ASSERT_TRUE(index.add(input + "/40", "out.png", "options", prints.back(), 1.0, error)) << error;
+    }
+    std::filesystem::copy_file(saved, manifest, std::filesystem::copy_options::overwrite_existing);
+    std::ofstream(segmentDir / "999999") << "partial";
+    const auto before = segmentCount();
+
+    FingerprintIndex index;
+    ASSERT_TRUE(index.open(directory, error)) << error;
+    EXPECT_FALSE(std::filesystem::exists(segmentDir / "999999"));
+    EXPECT_LE(segmentCount(), before);
+    ASSERT_EQ(index.size(), 41u);
+    for (size_t i : {size_t(0), size_t(17), size_t(40)}) {
+        auto matches = index.query(prints[i], 1);
+        ASSERT_EQ(matches.size(), 1u);
+        EXPECT_EQ(matches[0].entry->id, i);
+        EXPECT_NEAR(matches[0].similarity, 1.0, 1e-9);
+    }
+    std::filesystem::remove(saved);
+    std::filesystem::remove_all(input);
+}
+
+TEST(NarrowBandTest, ZoomFftAndGoertzelFindTone) {
+    const int sampleRate = 44100;
+    std::vector<double> samples(sampleRate * 2);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = 0.5 * std::sin(2 * M_PI * 440.0 * i / sampleRate);
+    }
+
+    // G#4 到 A#4 之间全频带 2048 点 FFT 只有两三个 bin
+    Spectrogram::Config spec;
+    spec.min_freq = 415.3;
+    spec.max_freq = 466.2;
+    EXPECT_TRUE(NarrowBandAnalyzer::applies(spec, sampleRate, 2048));
+    Spectrogram::Config wide = spec;
+    wide.max_freq = 4000;
+    EXPECT_FALSE(NarrowBandAnalyzer::applies(wide, sampleRate, 2048));
+
+    // 行数多时用缩放 FFT，行数少时用 Goertzel 组，两者都在行频率处给出同样的强度
+    const int hopSize = sampleRate / spec.samples_per_sec;
+    NarrowBandAnalyzer analyzer;
+    for (int height : {600, 40}) {
+        spec.height = height;
+        auto band = analyzer.compute(samples.data(), samples.size(), sampleRate, hopSize, spec, 2048);
+        EXPECT_EQ(analyzer.getMethod(),
+                  height == 600 ? NarrowBandAnalyzer::Method::ZoomFft : NarrowBandAnalyzer::Method::Goertzel);
+        ASSERT_EQ(band.freqs.size(), static_cast<size_t>(height));
+        EXPECT_EQ(band.frames.size(), (samples.size() + hopSize - 1) / hopSize);
+
+        const auto& frame = band.frames[band.frames.size() / 2];
+        size_t peak = std::max_element(frame.begin(), frame.end()) - frame.begin();
+        const double rowHz = (spec.max_freq - spec.min_freq) / height;
+        EXPECT_NEAR(band.freqs[peak], 440.0, rowHz);
+        // 振幅 0.5 即 -6 dB
+        EXPECT_NEAR(frame[peak], (80.0 - 6.02) / 80.0, 0.01);
+        EXPECT_LT(frame.front(), frame[peak] - 0.1);
+    }
+
+    // 频带边缘的音与中心的音强度相同，抽取前的低通滤波不衰减 [min_freq, max_freq] 内的信号
+    spec.height = 600;
+    auto peakIntensity = [&](double freq) {
+        std::vector<double> tone(sampleRate * 2);
+        for (size_t i = 0; i < tone.size(); ++i) {
+            tone[i] = 0.5 * std::sin(2 * M_PI * freq * i / sampleRate);
+        }
+        auto band = analyzer.compute(tone.data(), tone.size(), sampleRate, hopSize, spec, 2048);
+        const auto& frame = band.frames[band.frames.size() / 2];
+        return *std::max_element(frame.begin(), frame.end());
+    };
+    const double centre = peakIntensity((spec.min_freq + spec.max_freq) / 2);
+    EXPECT_NEAR(peakIntensity(spec.min_freq), centre, 0.01);
+    EXPECT_NEAR(peakIntensity(spec.max_freq), centre, 0.01);
+
+    // 分析入口自动选用窄带分析，每一行都对应到频率最近的值
+    spec.height = 600;
+    AnalyzerCache analyzers;
+    Spectrogram::Track track = analyzers.analyze(samples, sampleRate, spec, 2048, {});
+    ASSERT_EQ(track.size(), 1u);
+    EXPECT_EQ(track[0].freqs.size(), 600u);
+    Spectrogram spectrogram;
+    auto rows = spectrogram.mapRows(track, sampleRate, spec, 300);
+    for (const auto& row : rows) {
+        EXPECT_EQ(row.band, 0);
+        EXPECT_EQ(row.hi - row.lo, 1);
+    }
+}
+
+TEST(NoteOverlayTest, BlendsCachedGridlinesAndLabels) {
+    const int width = 400, height = 300;
+    const double minFreq = noteToFreq("C2");
+    const double maxFreq = noteToFreq("C7");
+
+    // 同样参数的叠加层只光栅化一次
+    auto overlay = NoteOverlay::get(width, height, 1, minFreq, maxFreq);
+    EXPECT_EQ(overlay, NoteOverlay::get(width, height, 1, minFreq, maxFreq));
+    EXPECT_NE(overlay, NoteOverlay::get(width, height, 2, minFreq, maxFreq));
+    EXPECT_GT(overlay->spanCount(), 0u);
+
+    std::vector<unsigned char> image(static_cast<size_t>(width) * height * 3, 0);
+    overlay->blend(image.data(), width * 3);
+    auto pixel = [&](int x, int y) { return image[(static_cast<size_t>(y) * width + x) * 3]; };
+
+    // A4 的刻度线与 Spectrogram::freqToY 的位置一致，半透明白色混合到黑色上为 128
+    const double logMin = std::log2(minFreq);
+    const double logMax = std::log2(maxFreq);
+    const int level = static_cast<int>(height * (std::log2(440.0) - logMin) / (logMax - logMin));
+    const int y = height - 1 - level;
+    EXPECT_EQ(pixel(width - 1, y), 128);
+    EXPECT_EQ(pixel(width - 1, y + 1), 0);
+    // 标签 "A" 的第一行以刻度线为中心，点阵为 .###.
+    EXPECT_EQ(pixel(5, y - 3), 0);
+    EXPECT_EQ(pixel(6, y - 3), 255);
+    EXPECT_EQ(pixel(8, y - 3), 255);
+
+    // 非黑色像素按 (dst * (255 - a) + c * a) / 255 四舍五入
+    std::vector<unsigned char> gray(static_cast<size_t>(width) * height * 3, 100);
+    overlay->blend(gray.data(), width * 3);
+    EXPECT_EQ(gray[(static_cast<size_t>(y) * width + width - 1) * 3], 178);
+    EXPECT_EQ(gray[(static_cast<size_t>(y + 1) * width + width - 1) * 3], 100);
+}
+
 int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();